@@ -0,0 +1,230 @@
+#define _GNU_SOURCE
+#include "bench.h"
+#include <fcntl.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SHELLECT_VERSION
+#define SHELLECT_VERSION "unknown"
+#endif
+
+// shell sources linked into the benchmarks print messages with it
+const char *sysname = "Shellect";
+
+struct bench_case {
+	const char *name;
+	int (*run)();
+};
+
+static const struct bench_case cases[] = {
+	{ "pipeline", bench_pipeline },
+	{ "builtin", bench_builtin },
+	{ "alias", bench_alias },
+	{ "launch", bench_launch },
+	{ "parser", bench_parser },
+	{ "history", bench_history },
+	{ "findstring", bench_findstring },
+	{ "dirsize", bench_dirsize },
+	{ "hexdump", bench_hexdump },
+};
+
+// one measurement, written to the JSON report
+typedef struct {
+	const char *bench_case;
+	char *name;
+	const char *unit;
+	double value;
+} BenchResult;
+
+static BenchResult *results;
+static size_t result_count, result_capacity;
+static const char *running_case;
+
+double bench_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double bench_run_shell(const char *script) {
+	int fds[2];
+	if (pipe(fds) == -1) {
+		perror("pipe");
+		return -1;
+	}
+
+	double start = bench_now();
+	pid_t pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		return -1;
+	}
+
+	if (pid == 0) {
+		int null_fd = open("/dev/null", O_WRONLY);
+		dup2(fds[0], STDIN_FILENO);
+		dup2(null_fd, STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		close(null_fd);
+		execl(SHELLECT_PATH, "shellect", (char *)NULL);
+		perror("execl");
+		_exit(EXIT_FAILURE);
+	}
+
+	close(fds[0]);
+	size_t len = strlen(script);
+	while (len > 0) {
+		ssize_t n = write(fds[1], script, len);
+		if (n <= 0)
+			break;
+		script += n;
+		len -= n;
+	}
+	close(fds[1]);
+
+	int status;
+	waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		return -1;
+	return bench_now() - start;
+}
+
+void bench_result(const char *unit, double value, const char *format, ...) {
+	if (result_count == result_capacity) {
+		result_capacity = result_capacity ? result_capacity * 2 : 64;
+		results = realloc(results, result_capacity * sizeof(BenchResult));
+	}
+	BenchResult *result = &results[result_count++];
+	va_list args;
+	va_start(args, format);
+	if (vasprintf(&result->name, format, args) == -1)
+		result->name = NULL;
+	va_end(args);
+	result->bench_case = running_case;
+	result->unit = unit;
+	result->value = value;
+}
+
+/**
+ * Writes a string as a JSON string literal.
+ */
+static void write_json_string(FILE *file, const char *string) {
+	fputc('"', file);
+	for (const char *c = string ? string : ""; *c; ++c) {
+		if (*c == '"' || *c == '\\')
+			fprintf(file, "\\%c", *c);
+		else if ((unsigned char)*c < 0x20)
+			fprintf(file, "\\u%04x", *c);
+		else
+			fputc(*c, file);
+	}
+	fputc('"', file);
+}
+
+/**
+ * Writes every recorded result, with the version and the machine they
+ * were measured on, so runs of different versions can be compared.
+ * @param failed Names of the cases that failed, NULL terminated.
+ * @return 0 on success, -1 if the file could not be written.
+ */
+static int write_json(const char *path, const char **failed) {
+	FILE *file = fopen(path, "w");
+	if (!file) {
+		perror(path);
+		return -1;
+	}
+
+	struct utsname host;
+	if (uname(&host) == -1)
+		memset(&host, 0, sizeof(host));
+	char timestamp[32];
+	time_t now = time(NULL);
+	strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ",
+			 gmtime(&now));
+
+	fprintf(file, "{\n  \"version\": ");
+	write_json_string(file, SHELLECT_VERSION);
+	fprintf(file, ",\n  \"timestamp\": ");
+	write_json_string(file, timestamp);
+	fprintf(file, ",\n  \"host\": {\"kernel\": ");
+	write_json_string(file, host.release);
+	fprintf(file, ", \"machine\": ");
+	write_json_string(file, host.machine);
+	fprintf(file, ", \"cpus\": %ld},\n  \"results\": [",
+			sysconf(_SC_NPROCESSORS_ONLN));
+
+	for (size_t i = 0; i < result_count; ++i) {
+		fprintf(file, "%s\n    {\"case\": ", i ? "," : "");
+		write_json_string(file, results[i].bench_case);
+		fprintf(file, ", \"name\": ");
+		write_json_string(file, results[i].name);
+		// JSON has no infinity or NaN
+		if (isfinite(results[i].value))
+			fprintf(file, ", \"value\": %.6g, \"unit\": ", results[i].value);
+		else
+			fprintf(file, ", \"value\": null, \"unit\": ");
+		write_json_string(file, results[i].unit);
+		fputc('}', file);
+	}
+
+	fprintf(file, "\n  ],\n  \"failed\": [");
+	for (int i = 0; failed[i]; ++i) {
+		fprintf(file, i ? ", " : "");
+		write_json_string(file, failed[i]);
+	}
+	fprintf(file, "]\n}\n");
+	return fclose(file) == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+	int ncases = sizeof(cases) / sizeof(cases[0]);
+	const char *json_path = NULL;
+	int selected_count = 0;
+	bool selected[sizeof(cases) / sizeof(cases[0])] = { false };
+
+	for (int j = 1; j < argc; ++j) {
+		if (strcmp(argv[j], "--json") == 0 && j + 1 < argc) {
+			json_path = argv[++j];
+			continue;
+		}
+		int i = 0;
+		while (i < ncases && strcmp(argv[j], cases[i].name) != 0)
+			i++;
+		if (i == ncases) {
+			fprintf(stderr, "Usage: %s [--json file] [case ...]\ncases:",
+					argv[0]);
+			for (i = 0; i < ncases; ++i)
+				fprintf(stderr, " %s", cases[i].name);
+			fprintf(stderr, "\n");
+			return EXIT_FAILURE;
+		}
+		selected[i] = true;
+		selected_count++;
+	}
+
+	const char *failed[sizeof(cases) / sizeof(cases[0]) + 1];
+	int failed_count = 0;
+	for (int i = 0; i < ncases; ++i) {
+		if (selected_count && !selected[i])
+			continue;
+		running_case = cases[i].name;
+		if (cases[i].run() != 0) {
+			fprintf(stderr, "%s: benchmark failed\n", cases[i].name);
+			failed[failed_count++] = cases[i].name;
+		}
+	}
+	failed[failed_count] = NULL;
+
+	if (json_path && write_json(json_path, failed) == -1)
+		return EXIT_FAILURE;
+	return failed_count ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,39 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/**
+ * Returns a monotonic timestamp in seconds.
+ */
+double bench_now();
+
+/**
+ * Runs the shellect binary with script as its standard input and its
+ * standard output discarded.
+ * @param script Commands to feed to the shell, one per line.
+ * @return Wall time in seconds from start to exit, or -1 on error.
+ */
+double bench_run_shell(const char *script);
+
+/**
+ * Records one measurement of the running case for the JSON report,
+ * next to the line the case prints for people.
+ * @param unit Unit of value, such as "MB/s" or "us".
+ * @param value The measurement.
+ * @param format printf format of the measurement's name, unique within
+ * the case, such as "group 4, 1 thread".
+ */
+void bench_result(const char *unit, double value, const char *format, ...)
+	__attribute__((format(printf, 3, 4)));
+
+// Benchmark cases, selected by name on the shellect_bench command line
+int bench_pipeline();
+int bench_builtin();
+int bench_alias();
+int bench_launch();
+int bench_parser();
+int bench_history();
+int bench_findstring();
+int bench_dirsize();
+int bench_hexdump();
+
+#endif // BENCH_H
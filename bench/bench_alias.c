@@ -0,0 +1,50 @@
+#include "alias.h"
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Aliases defined before timing, more than any real alias file has
+#define ALIAS_COUNT 10000
+// Lookups timed per case
+#define ALIAS_LOOKUPS 10000000L
+
+/**
+ * Times search_alias for names that are defined and for names that are
+ * not, which is what every command that is not an alias costs.
+ */
+int bench_alias() {
+	char name[32], body[64];
+	for (int i = 0; i < ALIAS_COUNT; ++i) {
+		snprintf(name, sizeof(name), "alias%d", i);
+		snprintf(body, sizeof(body), "git log --oneline -n %d", i);
+		add_alias(name, body);
+	}
+
+	// names are made up front so only the lookups are timed
+	enum { NAMES = 1024 };
+	static char hits[NAMES][32], misses[NAMES][32];
+	srand(42);
+	for (int i = 0; i < NAMES; ++i) {
+		snprintf(hits[i], sizeof(hits[i]), "alias%d", rand() % ALIAS_COUNT);
+		snprintf(misses[i], sizeof(misses[i]), "command%d", i);
+	}
+
+	const struct {
+		const char *name;
+		char (*names)[32];
+	} modes[] = { { "defined", hits }, { "not defined", misses } };
+	for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+		long found = 0;
+		double start = bench_now();
+		for (long i = 0; i < ALIAS_LOOKUPS; ++i)
+			found += search_alias(modes[m].names[i % NAMES]) != NULL;
+		double elapsed = bench_now() - start;
+		if (found != (m == 0 ? ALIAS_LOOKUPS : 0))
+			return -1;
+		printf("alias: %s: %.1f ns/lookup with %d aliases\n", modes[m].name,
+			   elapsed * 1e9 / ALIAS_LOOKUPS, ALIAS_COUNT);
+		bench_result("ns", elapsed * 1e9 / ALIAS_LOOKUPS, "%s lookup",
+					 modes[m].name);
+	}
+	return 0;
+}
@@ -0,0 +1,56 @@
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Commands per script, large enough to drown out shell startup
+#define BUILTIN_ITERATIONS 2000
+
+static double time_script(const char *line, double baseline) {
+	size_t line_len = strlen(line);
+	char *script = malloc(line_len * BUILTIN_ITERATIONS + sizeof("exit\n"));
+	char *p = script;
+	for (int i = 0; i < BUILTIN_ITERATIONS; ++i) {
+		memcpy(p, line, line_len);
+		p += line_len;
+	}
+	strcpy(p, "exit\n");
+
+	double seconds = bench_run_shell(script);
+	free(script);
+	if (seconds < 0)
+		return -1;
+	return (seconds - baseline) / BUILTIN_ITERATIONS;
+}
+
+/**
+ * Compares the latency of the same builtin run inside the shell and in a
+ * forked child, as every builtin ran before. The child is forced by
+ * running the builtin in the background and waiting for it, which adds
+ * only an in-process "wait".
+ */
+int bench_builtin() {
+	char dir[] = "/tmp/shellect_bench_XXXXXX";
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return -1;
+	}
+
+	char in_process[128], forked[128];
+	snprintf(in_process, sizeof(in_process), "dirsize %s\n", dir);
+	snprintf(forked, sizeof(forked), "dirsize %s &\nwait\n", dir);
+
+	double baseline = bench_run_shell("exit\n");
+	double builtin = time_script(in_process, baseline);
+	double child = time_script(forked, baseline);
+	rmdir(dir);
+	if (baseline < 0 || builtin < 0 || child < 0)
+		return -1;
+
+	printf("builtin: in-process %.2f us/command\n", builtin * 1e6);
+	printf("builtin: forked     %.2f us/command\n", child * 1e6);
+	bench_result("us", builtin * 1e6, "dirsize in-process");
+	bench_result("us", child * 1e6, "dirsize in a forked child");
+	return 0;
+}
@@ -0,0 +1,142 @@
+#include "bench.h"
+#include "dirsize.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Generated tree: TREE_TOP directories of TREE_MIDDLE directories of
+// TREE_FILES files each, one million files in all
+#define TREE_TOP 10
+#define TREE_MIDDLE 100
+#define TREE_FILES 1000
+
+static char tree[] = "/tmp/shellect_tree_XXXXXX";
+
+/**
+ * Creates or removes every file and directory of the tree.
+ * @return 0 on success, -1 on the first error when creating.
+ */
+static int build_tree(int create) {
+	char path[sizeof(tree) + 64];
+	for (int top = 0; top < TREE_TOP; ++top) {
+		snprintf(path, sizeof(path), "%s/t%d", tree, top);
+		if (create && mkdir(path, 0755) == -1) {
+			perror("mkdir");
+			return -1;
+		}
+		for (int middle = 0; middle < TREE_MIDDLE; ++middle) {
+			snprintf(path, sizeof(path), "%s/t%d/m%d", tree, top, middle);
+			if (create && mkdir(path, 0755) == -1) {
+				perror("mkdir");
+				return -1;
+			}
+			int dir_fd = open(path, O_RDONLY | O_DIRECTORY);
+			for (int i = 0; i < TREE_FILES && dir_fd != -1; ++i) {
+				char name[16];
+				snprintf(name, sizeof(name), "f%d", i);
+				if (!create) {
+					unlinkat(dir_fd, name, 0);
+					continue;
+				}
+				int fd = openat(dir_fd, name, O_WRONLY | O_CREAT, 0644);
+				if (fd == -1) {
+					perror("openat");
+					close(dir_fd);
+					return -1;
+				}
+				// sparse, the sizes cost no disk space
+				int truncated = ftruncate(fd, i);
+				close(fd);
+				if (truncated == -1) {
+					perror("ftruncate");
+					close(dir_fd);
+					return -1;
+				}
+			}
+			if (dir_fd != -1)
+				close(dir_fd);
+			if (!create)
+				rmdir(path);
+		}
+		snprintf(path, sizeof(path), "%s/t%d", tree, top);
+		if (!create)
+			rmdir(path);
+	}
+	if (!create)
+		rmdir(tree);
+	return 0;
+}
+
+/**
+ * Times one walk.
+ * @param io_uring Set to whether io_uring did the walk, may be NULL.
+ * @return Seconds taken, or -1 if the walk did not count every file.
+ */
+static double time_walk(const DirSizeOptions *options, int *io_uring) {
+	double start = bench_now();
+	DirSizeResult result = calculate_directory_size(options);
+	double elapsed = bench_now() - start;
+	dirsize_result_free(&result);
+	if (io_uring)
+		*io_uring = result.io_uring;
+	if (result.files != (unsigned long long)TREE_TOP * TREE_MIDDLE * TREE_FILES)
+		return -1;
+	return elapsed;
+}
+
+/**
+ * Generates a tree of one million files and walks it with one thread,
+ * with one thread per CPU and, when the kernel has it, with batched statx
+ * calls through io_uring. The tree is walked once first so every case
+ * runs on a warm cache, where the cost is in the system calls rather than
+ * the device.
+ */
+int bench_dirsize() {
+	if (!mkdtemp(tree)) {
+		perror("mkdtemp");
+		return -1;
+	}
+	if (build_tree(1) == -1) {
+		build_tree(0);
+		return -1;
+	}
+
+	DirSizeOptions options = { .path = tree, .recursive = 1 };
+	time_walk(&options, NULL); // warm up
+
+	const struct {
+		const char *name;
+		int threads;
+		int io_uring;
+	} modes[] = {
+		{ "1 thread", 1, 0 },
+		{ "all CPUs", 0, 0 },
+		{ "io_uring", 1, 1 },
+	};
+	int failed = 0;
+	double files = (double)TREE_TOP * TREE_MIDDLE * TREE_FILES;
+	for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+		options.threads = modes[i].threads;
+		options.io_uring = modes[i].io_uring;
+		int io_uring;
+		double elapsed = time_walk(&options, &io_uring);
+		if (elapsed < 0) {
+			failed = 1;
+			continue;
+		}
+		// the walk falls back to threads without io_uring or its statx
+		if (modes[i].io_uring && !io_uring) {
+			printf("dirsize: %s: skipped, not available\n", modes[i].name);
+			continue;
+		}
+		printf("dirsize: %s: %.0f files/s, %.0f ms for %.0f files\n",
+			   modes[i].name, files / elapsed, elapsed * 1e3, files);
+		bench_result("files/s", files / elapsed, "%s", modes[i].name);
+	}
+
+	build_tree(0);
+	return failed ? -1 : 0;
+}
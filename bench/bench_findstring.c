@@ -0,0 +1,159 @@
+#include "bench.h"
+#include "findindex.h"
+#include "findstring.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Files in the generated corpus and the size of each
+#define CORPUS_FILES 32
+#define CORPUS_FILE_SIZE (8L << 20)
+
+// Planted near the end of every other file, so most of each file is scanned
+#define CORPUS_NEEDLE "needle-7f3a9c"
+
+static char corpus[] = "/tmp/shellect_corpus_XXXXXX";
+
+static int generate_corpus() {
+	if (!mkdtemp(corpus)) {
+		perror("mkdtemp");
+		return -1;
+	}
+	srand(42); // same corpus on every run
+	char path[sizeof(corpus) + 32];
+	for (int i = 0; i < CORPUS_FILES; ++i) {
+		snprintf(path, sizeof(path), "%s/log%02d.txt", corpus, i);
+		FILE *file = fopen(path, "w");
+		if (!file) {
+			perror("fopen");
+			return -1;
+		}
+		long written = 0, line = 0;
+		while (written < CORPUS_FILE_SIZE) {
+			written += fprintf(
+				file, "2024-01-%02d 12:%02d:%02d worker%d request %d took %d ms\n",
+				1 + rand() % 28, rand() % 60, rand() % 60, rand() % 64, rand(),
+				rand() % 1000);
+			if (i % 2 == 0 && ++line == 120000)
+				written += fprintf(file, "error: %s in handler\n", CORPUS_NEEDLE);
+		}
+		fclose(file);
+	}
+	return 0;
+}
+
+static void remove_corpus() {
+	char path[sizeof(corpus) + 32];
+	for (int i = 0; i < CORPUS_FILES; ++i) {
+		snprintf(path, sizeof(path), "%s/log%02d.txt", corpus, i);
+		unlink(path);
+	}
+	rmdir(corpus);
+}
+
+/**
+ * Times one search with stdout sent to /dev/null.
+ * @return Seconds taken.
+ */
+static double time_search(const FindStringOptions *options) {
+	fflush(stdout);
+	int saved = dup(STDOUT_FILENO);
+	int null_fd = open("/dev/null", O_WRONLY);
+	dup2(null_fd, STDOUT_FILENO);
+	close(null_fd);
+
+	double start = bench_now();
+	find_string(options);
+	fflush(stdout);
+	double elapsed = bench_now() - start;
+
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	return elapsed;
+}
+
+/**
+ * Generates CORPUS_FILES log files and searches them for a string found in
+ * half of them, with one thread and with one per CPU, for the first match
+ * and for every match. Files are read once first so every case is timed
+ * on a warm page cache. Then a list of patterns and a regular expression
+ * are searched, and the trigram index is built, updated with no changes,
+ * and used for the first search.
+ */
+int bench_findstring() {
+	if (generate_corpus() == -1) {
+		remove_corpus();
+		return -1;
+	}
+
+	FindStringOptions options = { .pattern = CORPUS_NEEDLE, .path = corpus };
+	time_search(&options); // warm up
+
+	const struct {
+		const char *name;
+		int threads;
+		bool all_matches;
+	} modes[] = {
+		{ "first match, 1 thread", 1, false },
+		{ "first match, all CPUs", 0, false },
+		{ "all matches, 1 thread", 1, true },
+		{ "all matches, all CPUs", 0, true },
+	};
+	double total = (double)CORPUS_FILES * CORPUS_FILE_SIZE;
+	for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+		options.threads = modes[i].threads;
+		options.all_matches = modes[i].all_matches;
+		double elapsed = time_search(&options);
+		printf("findstring: %s: %.2f GB/s over %.0f MB\n", modes[i].name,
+			   total / elapsed / 1e9, total / 1e6);
+		bench_result("GB/s", total / elapsed / 1e9, "%s", modes[i].name);
+	}
+
+	// ten signatures in one Aho-Corasick pass, then a regular expression
+	static const char *const signatures[] = {
+		CORPUS_NEEDLE, "segfault",	"out of memory", "timeout",
+		"panic:",	   "deadlock",	"EIO",			 "connection reset",
+		"assertion",   "corrupted",
+	};
+	static const char *const regex[] = { "worker6[0-3] request [0-9]+9 took 99" };
+	options.all_matches = true;
+	options.patterns = signatures;
+	options.pattern_count = sizeof(signatures) / sizeof(signatures[0]);
+	double elapsed = time_search(&options);
+	printf("findstring: %zu patterns, all CPUs: %.2f GB/s\n",
+		   options.pattern_count, total / elapsed / 1e9);
+	bench_result("GB/s", total / elapsed / 1e9, "%zu patterns, all CPUs",
+				 options.pattern_count);
+	options.patterns = regex;
+	options.pattern_count = 1;
+	options.regex = true;
+	elapsed = time_search(&options);
+	printf("findstring: regex, all CPUs: %.2f GB/s\n", total / elapsed / 1e9);
+	bench_result("GB/s", total / elapsed / 1e9, "regex, all CPUs");
+	options.patterns = NULL;
+	options.pattern_count = 0;
+	options.regex = false;
+
+	// with the index, the files without the needle are not read at all
+	options.threads = 0;
+	options.all_matches = false;
+	options.build_index = true;
+	double build = time_search(&options);
+	double update = time_search(&options);
+	options.build_index = false;
+	double indexed = time_search(&options);
+	printf("findstring: index build %.0f ms, update %.1f ms, "
+		   "indexed search %.1f ms\n",
+		   build * 1e3, update * 1e3, indexed * 1e3);
+	bench_result("ms", build * 1e3, "index build");
+	bench_result("ms", update * 1e3, "index update");
+	bench_result("ms", indexed * 1e3, "indexed search");
+
+	char path[sizeof(corpus) + 32];
+	snprintf(path, sizeof(path), "%s/" FINDINDEX_FILE, corpus);
+	unlink(path);
+	remove_corpus();
+	return 0;
+}
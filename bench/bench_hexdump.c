@@ -0,0 +1,85 @@
+#include "bench.h"
+#include "hexdump.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Size of the generated input
+#define DUMP_SIZE (64L << 20)
+
+static char input[] = "/tmp/shellect_dump_XXXXXX";
+
+/**
+ * Times one dump with stdout sent to /dev/null.
+ * @return Seconds taken.
+ */
+static double time_dump(const HexdumpConfig *config) {
+	fflush(stdout);
+	int saved = dup(STDOUT_FILENO);
+	int null_fd = open("/dev/null", O_WRONLY);
+	dup2(null_fd, STDOUT_FILENO);
+	close(null_fd);
+
+	double start = bench_now();
+	hexdump(config);
+	double elapsed = bench_now() - start;
+
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	return elapsed;
+}
+
+/**
+ * Dumps a file of random bytes with every group size, and with the
+ * ASCII column, on one thread, then with one thread per CPU, and
+ * reports the input throughput.
+ */
+int bench_hexdump() {
+	int fd = mkstemp(input);
+	if (fd == -1) {
+		perror("mkstemp");
+		return -1;
+	}
+	srand(42);
+	unsigned char *data = malloc(DUMP_SIZE);
+	for (long i = 0; i < DUMP_SIZE; ++i)
+		data[i] = rand();
+	int written = write(fd, data, DUMP_SIZE) == DUMP_SIZE;
+	free(data);
+	close(fd);
+	if (!written) {
+		perror("write");
+		unlink(input);
+		return -1;
+	}
+
+	HexdumpConfig config = { .group_size = 1, .filename = input, .length = -1,
+							 .threads = 1 };
+	time_dump(&config); // warm up
+
+	const struct {
+		int group_size;
+		int ascii;
+		int threads;
+	} modes[] = {
+		{ 1, 0, 1 }, { 2, 0, 1 }, { 4, 0, 1 }, { 8, 0, 1 },
+		{ 16, 0, 1 }, { 1, 1, 1 }, { 1, 0, 0 }, { 1, 1, 0 },
+	};
+	for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+		config.group_size = modes[i].group_size;
+		config.ascii = modes[i].ascii;
+		config.threads = modes[i].threads;
+		double elapsed = time_dump(&config);
+		printf("hexdump: group %d%s, %s: %.0f MB/s over %ld MB\n",
+			   config.group_size, config.ascii ? ", ASCII" : "",
+			   config.threads ? "1 thread" : "all CPUs",
+			   DUMP_SIZE / elapsed / 1e6, DUMP_SIZE >> 20);
+		bench_result("MB/s", DUMP_SIZE / elapsed / 1e6, "group %d%s, %s",
+					 config.group_size, config.ascii ? ", ASCII" : "",
+					 config.threads ? "1 thread" : "all CPUs");
+	}
+
+	unlink(input);
+	return 0;
+}
@@ -0,0 +1,67 @@
+#include "bench.h"
+#include "history.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// History lines written to the generated history file
+#define HISTORY_LINES 200000
+
+// Reverse searches timed after loading
+#define HISTORY_SEARCHES 1000
+
+/**
+ * Loads a generated history file of HISTORY_LINES lines and times
+ * history_load, then incremental searches the way Ctrl-R issues them:
+ * one search per typed character, each continuing from the last match.
+ */
+int bench_history() {
+	char path[] = "/tmp/shellect_history_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd == -1) {
+		perror("mkstemp");
+		return -1;
+	}
+
+	FILE *file = fdopen(fd, "w");
+	srand(42); // same history on every run
+	for (int i = 0; i < HISTORY_LINES; ++i)
+		fprintf(file, "git commit -m 'change %d' --author=user%d src/file%d.c\n",
+				i, rand() % 1000, rand() % 50000);
+	fclose(file);
+
+	double start = bench_now();
+	history_load(path);
+	double load = bench_now() - start;
+
+	// the first search also builds the trigram index
+	start = bench_now();
+	history_search("file", 4, history_end());
+	double index = bench_now() - start;
+
+	char query[32];
+	long found = 0;
+	start = bench_now();
+	for (int i = 0; i < HISTORY_SEARCHES; ++i) {
+		int len = snprintf(query, sizeof(query), "file%d.c", rand() % 50000);
+		long match = history_end();
+		for (int typed = 1; typed <= len; ++typed) {
+			long id = history_search(query, typed, match + 1);
+			if (id != -1)
+				match = id;
+		}
+		found += match != history_end();
+	}
+	double search = bench_now() - start;
+	unlink(path);
+
+	printf("history: load %.2f ms, index %.2f ms for %ld entries\n",
+		   load * 1e3, index * 1e3, history_end() - history_first());
+	printf("history: %.1f us per incremental search (%ld/%d found)\n",
+		   search * 1e6 / HISTORY_SEARCHES, found, HISTORY_SEARCHES);
+	bench_result("ms", load * 1e3, "load");
+	bench_result("ms", index * 1e3, "index");
+	bench_result("us", search * 1e6 / HISTORY_SEARCHES, "incremental search");
+	return 0;
+}
@@ -0,0 +1,82 @@
+#include "bench.h"
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Launches timed per strategy and heap size
+#define LAUNCH_ITERATIONS 200
+
+extern char **environ;
+
+static char *const true_argv[] = { "true", NULL };
+
+static int launch_fork() {
+	pid_t pid = fork();
+	if (pid == -1)
+		return -1;
+	if (pid == 0) {
+		execvp(true_argv[0], true_argv);
+		_exit(EXIT_FAILURE);
+	}
+	return waitpid(pid, NULL, 0) == pid ? 0 : -1;
+}
+
+static int launch_spawn() {
+	pid_t pid;
+	if (posix_spawnp(&pid, true_argv[0], NULL, NULL, true_argv, environ))
+		return -1;
+	return waitpid(pid, NULL, 0) == pid ? 0 : -1;
+}
+
+static double time_launches(int (*launch)()) {
+	double start = bench_now();
+	for (int i = 0; i < LAUNCH_ITERATIONS; ++i) {
+		if (launch() == -1)
+			return -1;
+	}
+	return (bench_now() - start) / LAUNCH_ITERATIONS;
+}
+
+/**
+ * Measures launch latency of fork+exec and posix_spawn, the two paths
+ * run_pipeline uses, while this process holds a growing resident heap
+ * that stands in for a long-lived shell.
+ */
+int bench_launch() {
+	const size_t rss_mib[] = { 0, 64, 256, 1024 };
+	char *heap = NULL;
+
+	for (size_t i = 0; i < sizeof(rss_mib) / sizeof(rss_mib[0]); ++i) {
+		size_t size = rss_mib[i] << 20;
+		free(heap);
+		heap = NULL;
+		if (size) {
+			heap = malloc(size);
+			if (!heap) {
+				perror("malloc");
+				return -1;
+			}
+			memset(heap, 1, size); // make it resident
+		}
+
+		double forked = time_launches(launch_fork);
+		double spawned = time_launches(launch_spawn);
+		if (forked < 0 || spawned < 0) {
+			free(heap);
+			return -1;
+		}
+
+		printf("launch: rss %4zu MiB: fork+exec %8.1f us, posix_spawn "
+			   "%8.1f us\n",
+			   rss_mib[i], forked * 1e6, spawned * 1e6);
+		bench_result("us", forked * 1e6, "fork+exec, rss %zu MiB", rss_mib[i]);
+		bench_result("us", spawned * 1e6, "posix_spawn, rss %zu MiB",
+					 rss_mib[i]);
+	}
+
+	free(heap);
+	return 0;
+}
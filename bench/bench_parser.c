@@ -0,0 +1,112 @@
+#include "bench.h"
+#include "arena.h"
+#include "parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Times every line of the corpus is parsed
+#define PARSER_ROUNDS 100000
+
+// Bytes parsed for each generated long line length
+#define PARSER_LONG_BYTES (64L * 1024 * 1024)
+
+static const char *corpus[] = {
+	"ls -la",
+	"cd /usr/local/share",
+	"grep -n needle file1.txt file2.txt file3.txt >>matches.txt",
+	"cat <input.txt | sort | uniq -c | sort -rn | head -20 >top.txt",
+	"hexdump -g 4 /bin/ls | head",
+	"make -j8 CC=gcc CFLAGS=-O2 all install &",
+	"find . -name '*.c' -newer Makefile | xargs wc -l | tail -1",
+};
+
+// pieces long lines are built from: words, quotes, escapes and operators
+static const char *fragments[] = {
+	"word", "--long-option=value", "'single quoted text'",
+	"\"double \\\"quoted\\\" text\"", "escaped\\ space", ">out.txt",
+	"<in.txt", "| filter -x", ">>log.txt", "/usr/local/bin/tool",
+};
+
+static char *generate_line(size_t size) {
+	int nfragments = sizeof(fragments) / sizeof(fragments[0]);
+	char *line = malloc(size + 64);
+	size_t len = 0;
+
+	srand(42); // same corpus on every run
+	strcpy(line, "cmd");
+	len = 3;
+	while (len < size) {
+		const char *fragment = fragments[rand() % nfragments];
+		len += sprintf(line + len, " %s", fragment);
+	}
+	return line;
+}
+
+/**
+ * Parses generated lines of growing length. With a single-pass lexer the
+ * cost per byte stays flat as lines get longer.
+ */
+static int bench_long_lines() {
+	const size_t sizes[] = { 1024, 16 * 1024, 256 * 1024, 4 * 1024 * 1024 };
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		char *line = generate_line(sizes[i]);
+		size_t len = strlen(line);
+		char *copy = malloc(len + 1);
+		long rounds = PARSER_LONG_BYTES / len + 1;
+
+		double start = bench_now();
+		for (long round = 0; round < rounds; ++round) {
+			struct command_t *command = calloc(1, sizeof(struct command_t));
+			memcpy(copy, line, len + 1);
+			parse_command(copy, command);
+			free_command(command);
+		}
+		double seconds = bench_now() - start;
+
+		printf("parser: %7zu byte lines: %.1f MiB/s, %.2f ns/byte\n", len,
+			   rounds * len / seconds / (1 << 20),
+			   seconds * 1e9 / (rounds * len));
+		bench_result("MiB/s", rounds * len / seconds / (1 << 20),
+					 "%zu byte lines", len);
+		free(copy);
+		free(line);
+	}
+	return 0;
+}
+
+/**
+ * Parses a fixed corpus of command lines and reports lines/s, together
+ * with how many objects each line allocates and how many malloc calls the
+ * arena needed for them.
+ */
+int bench_parser() {
+	int ncorpus = sizeof(corpus) / sizeof(corpus[0]);
+	size_t allocations = 0, blocks = 0;
+	char line[4096];
+
+	double start = bench_now();
+	for (int round = 0; round < PARSER_ROUNDS; ++round) {
+		for (int i = 0; i < ncorpus; ++i) {
+			struct command_t *command = calloc(1, sizeof(struct command_t));
+			strcpy(line, corpus[i]); // parse_command works in place
+			parse_command(line, command);
+			allocations += command->arena->allocations;
+			// the command struct itself is one more malloc
+			blocks += command->arena->blocks + 1;
+			free_command(command);
+		}
+	}
+	double seconds = bench_now() - start;
+
+	long lines = (long)PARSER_ROUNDS * ncorpus;
+	printf("parser: %.0f lines/s, %.1f ns/line\n", lines / seconds,
+		   seconds * 1e9 / lines);
+	// each object used to be a malloc of its own
+	printf("parser: %.1f allocations/line served by %.2f mallocs/line\n",
+		   (double)(allocations + lines) / lines, (double)blocks / lines);
+	bench_result("lines/s", lines / seconds, "corpus");
+	bench_result("mallocs/line", (double)blocks / lines, "corpus mallocs");
+	return bench_long_lines();
+}
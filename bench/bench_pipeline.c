@@ -0,0 +1,40 @@
+#include "bench.h"
+#include <stdio.h>
+#include <string.h>
+
+// Bytes pushed through every pipeline
+#define PIPELINE_BYTES (1024L * 1024 * 1024)
+
+/**
+ * Streams PIPELINE_BYTES through producer | cat ... | wc -c chains of
+ * increasing length and reports the throughput of each.
+ */
+int bench_pipeline() {
+	const int stage_counts[] = { 2, 3, 5, 8 };
+	char script[512];
+
+	// startup and exit of the shell itself is subtracted from each run
+	double baseline = bench_run_shell("exit\n");
+	if (baseline < 0)
+		return -1;
+
+	for (size_t i = 0; i < sizeof(stage_counts) / sizeof(int); ++i) {
+		int len = snprintf(script, sizeof(script), "head -c %ld /dev/zero",
+						   PIPELINE_BYTES);
+		for (int s = 2; s < stage_counts[i]; ++s)
+			len += snprintf(script + len, sizeof(script) - len, " | cat");
+		snprintf(script + len, sizeof(script) - len, " | wc -c\nexit\n");
+
+		double seconds = bench_run_shell(script);
+		if (seconds < 0)
+			return -1;
+		seconds -= baseline;
+
+		printf("pipeline: %d stages, %ld MiB in %.3f s (%.1f MiB/s)\n",
+			   stage_counts[i], PIPELINE_BYTES >> 20, seconds,
+			   (PIPELINE_BYTES >> 20) / seconds);
+		bench_result("MiB/s", (PIPELINE_BYTES >> 20) / seconds, "%d stages",
+					 stage_counts[i]);
+	}
+	return 0;
+}
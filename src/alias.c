@@ -0,0 +1,182 @@
+#include "alias.h"
+#include "shell.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ALIAS_MIN_CAPACITY 32
+
+typedef struct {
+	char *name;
+	char *body;
+} Alias;
+
+static Alias *table; // open addressing, linear probing
+static size_t capacity, count;
+static bool dirty; // defined since the last load or save
+static char *file_path;
+
+static unsigned long hash_name(const char *name, size_t len) {
+	unsigned long hash = 14695981039346656037UL; // FNV-1a
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= (unsigned char)name[i];
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+static Alias *find_slot(Alias *slots, size_t size, const char *name,
+						size_t len) {
+	size_t i = hash_name(name, len) & (size - 1);
+	while (slots[i].name && (strncmp(slots[i].name, name, len) != 0 ||
+							 slots[i].name[len] != 0))
+		i = (i + 1) & (size - 1);
+	return &slots[i];
+}
+
+static void grow() {
+	size_t new_capacity = capacity ? capacity * 2 : ALIAS_MIN_CAPACITY;
+	Alias *slots = calloc(new_capacity, sizeof(Alias));
+	for (size_t i = 0; i < capacity; ++i) {
+		if (table[i].name)
+			*find_slot(slots, new_capacity, table[i].name,
+					   strlen(table[i].name)) = table[i];
+	}
+	free(table);
+	table = slots;
+	capacity = new_capacity;
+}
+
+/**
+ * Stores an alias, the name and body are copied.
+ * @param replace Whether an existing definition is overwritten.
+ */
+static void define(const char *name, size_t name_len, const char *body,
+				   size_t body_len, bool replace) {
+	if ((count + 1) * 4 > capacity * 3)
+		grow();
+	Alias *slot = find_slot(table, capacity, name, name_len);
+	if (slot->name) {
+		if (!replace)
+			return;
+		free(slot->body);
+	} else {
+		slot->name = strndup(name, name_len);
+		count++;
+	}
+	slot->body = strndup(body, body_len);
+}
+
+void add_alias(const char *alias_name, const char *command_string) {
+	define(alias_name, strlen(alias_name), command_string,
+		   strlen(command_string), true);
+	dirty = true;
+}
+
+const char *search_alias(const char *alias_name) {
+	if (!count)
+		return NULL;
+	Alias *slot = find_slot(table, capacity, alias_name, strlen(alias_name));
+	// If there is not alias found, it returns null
+	return slot->body;
+}
+
+void list_aliases(void (*callback)(const char *name, void *data), void *data) {
+	for (size_t i = 0; i < capacity; ++i) {
+		if (table[i].name)
+			callback(table[i].name, data);
+	}
+}
+
+void load_aliases() {
+	char cwd[PATH_MAX];
+	if (!getcwd(cwd, sizeof(cwd)))
+		return;
+	size_t path_len = strlen(cwd) + sizeof(ALIAS_FILE) + 1;
+	file_path = malloc(path_len);
+	snprintf(file_path, path_len, "%s/%s", cwd, ALIAS_FILE);
+
+	int fd = open(file_path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		//If no alias file is found
+		return;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == -1 || st.st_size == 0) {
+		close(fd);
+		return;
+	}
+	char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return;
+
+	static const char keyword[] = "alias ";
+	const size_t keyword_len = sizeof(keyword) - 1;
+	const char *end = map + st.st_size;
+	for (const char *line = map; line < end;) {
+		const char *newline = memchr(line, '\n', end - line);
+		const char *line_end = newline ? newline : end;
+
+		if (line_end - line > (long)keyword_len &&
+			memcmp(line, keyword, keyword_len) == 0) {
+			const char *name = line + keyword_len;
+			const char *space = memchr(name, ' ', line_end - name);
+			// the body is the rest of the line, spaces included. Files
+			// written by older versions listed the newest definition
+			// first, so an earlier line wins over a later one
+			if (space && space > name && space + 1 < line_end)
+				define(name, space - name, space + 1, line_end - space - 1,
+					   false);
+		}
+		line = line_end + 1;
+	}
+	munmap(map, st.st_size);
+}
+
+void save_aliases() {
+	if (!dirty || !file_path)
+		return;
+
+	size_t len = 0, size = 0;
+	for (size_t i = 0; i < capacity; ++i) {
+		if (table[i].name)
+			size += sizeof("alias  \n") + strlen(table[i].name) +
+					strlen(table[i].body);
+	}
+	char *text = malloc(size + 1);
+	for (size_t i = 0; i < capacity; ++i) {
+		if (table[i].name)
+			len += sprintf(text + len, "alias %s %s\n", table[i].name,
+						   table[i].body);
+	}
+
+	size_t temp_len = strlen(file_path) + 32;
+	char *temp_path = malloc(temp_len);
+	snprintf(temp_path, temp_len, "%s.%d.tmp", file_path, (int)getpid());
+	int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		perror("Error opening file for writing aliases");
+		free(text);
+		free(temp_path);
+		return;
+	}
+	ssize_t written = write(fd, text, len);
+	// the data must reach the disk before the rename does, or a power loss
+	// can leave an empty file in place of the old one
+	bool synced = written == (ssize_t)len && fsync(fd) == 0;
+	if (close(fd) == -1 || !synced || rename(temp_path, file_path) == -1) {
+		perror("Error writing aliases");
+		unlink(temp_path);
+	} else {
+		dirty = false;
+	}
+	free(text);
+	free(temp_path);
+}
@@ -0,0 +1,40 @@
+#ifndef ALIAS_H
+#define ALIAS_H
+
+// alias file, relative to the directory the shell starts in
+#define ALIAS_FILE "aliases.txt"
+
+/**
+ * Defines an alias, replacing any earlier definition of the same name.
+ * @param alias_name Name typed in command position.
+ * @param command_string Words that replace it, separated by blanks.
+ */
+void add_alias(const char *alias_name, const char *command_string);
+
+/**
+ * Looks an alias up in the hash table.
+ * @return The body of the alias, or NULL if there is none.
+ */
+const char *search_alias(const char *alias_name);
+
+/**
+ * Calls callback with the name of every alias, used by tab completion.
+ */
+void list_aliases(void (*callback)(const char *name, void *data), void *data);
+
+/**
+ * Maps the alias file and parses it in one pass. Each line holds
+ * "alias <name> <body>", where the body runs to the end of the line.
+ * The file is remembered by absolute path so that a later cd does not
+ * change where it is saved.
+ */
+void load_aliases();
+
+/**
+ * Writes the aliases back if any was defined since they were loaded. The
+ * file is written next to the old one, synced and renamed over it, so a
+ * crash or a power loss never leaves it half written.
+ */
+void save_aliases();
+
+#endif // ALIAS_H
@@ -0,0 +1,97 @@
+#include "arena.h"
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Sized so that the arena, its first block and a usual command line fit in
+// one page
+#define ARENA_BLOCK_SIZE 4096
+
+#define ARENA_ALIGN alignof(max_align_t)
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size; // usable bytes in data
+	size_t used;
+	alignas(max_align_t) char data[];
+};
+
+static struct arena_block *new_block(size_t size) {
+	struct arena_block *block = malloc(sizeof(struct arena_block) + size);
+	if (!block) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+Arena *arena_create() {
+	// the arena header lives at the start of the first block
+	struct arena_block *block =
+		new_block(ARENA_BLOCK_SIZE - sizeof(struct arena_block));
+	Arena *arena = (Arena *)block->data;
+	block->used = (sizeof(Arena) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	arena->head = block;
+	arena->allocations = 0;
+	arena->blocks = 1;
+	return arena;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+	struct arena_block *block = arena->head;
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	arena->allocations++;
+
+	if (block->size - block->used < size) {
+		size_t block_size = ARENA_BLOCK_SIZE - sizeof(struct arena_block);
+		if (size > block_size / 4) {
+			// big objects get a block of their own behind the current one,
+			// so the space left in the current block is not wasted
+			struct arena_block *big = new_block(size);
+			big->used = size;
+			big->next = block->next;
+			block->next = big;
+			arena->blocks++;
+			return big->data;
+		}
+		block = new_block(block_size);
+		block->next = arena->head;
+		arena->head = block;
+		arena->blocks++;
+	}
+
+	void *result = block->data + block->used;
+	block->used += size;
+	return result;
+}
+
+void *arena_calloc(Arena *arena, size_t size) {
+	return memset(arena_alloc(arena, size), 0, size);
+}
+
+char *arena_strndup(Arena *arena, const char *string, size_t len) {
+	char *copy = arena_alloc(arena, len + 1);
+	memcpy(copy, string, len);
+	copy[len] = 0;
+	return copy;
+}
+
+char *arena_strdup(Arena *arena, const char *string) {
+	return arena_strndup(arena, string, strlen(string));
+}
+
+void arena_destroy(Arena *arena) {
+	struct arena_block *block = arena->head;
+	// the arena itself lives in one of the blocks, never touch it after
+	// the loop has started
+	while (block) {
+		struct arena_block *next = block->next;
+		free(block);
+		block = next;
+	}
+}
@@ -0,0 +1,34 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct arena_block;
+
+typedef struct arena {
+	struct arena_block *head; // Block allocations are currently served from
+	size_t allocations; // Objects handed out since the arena was created
+	size_t blocks; // malloc calls made for those objects
+} Arena;
+
+/**
+ * Creates an empty arena. The arena and its first block share one malloc.
+ */
+Arena *arena_create();
+
+/**
+ * Bump-allocates size bytes, aligned for any type. Never returns NULL;
+ * the shell exits if memory runs out.
+ */
+void *arena_alloc(Arena *arena, size_t size);
+void *arena_calloc(Arena *arena, size_t size);
+char *arena_strdup(Arena *arena, const char *string);
+char *arena_strndup(Arena *arena, const char *string, size_t len);
+
+/**
+ * Releases the arena and everything allocated from it. A typical command
+ * line fits in the first block, so this is a single free.
+ */
+void arena_destroy(Arena *arena);
+
+#endif // ARENA_H
@@ -0,0 +1,540 @@
+#define _GNU_SOURCE
+#include "builtins.h"
+#include "alias.h"
+#include "arena.h"
+#include "dirsize.h"
+#include "dirsizecache.h"
+#include "findstring.h"
+#include "good_morning.h"
+#include "hexdump.h"
+#include "jobs.h"
+#include "parallel.h"
+#include "pathcache.h"
+#include "pipeline.h"
+#include "prompt.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+// args holds the name, the arguments and a NULL terminator
+#define ARGC(command) ((command)->arg_count - 1)
+
+static int builtin_alias(struct command_t *command) {
+	if (ARGC(command) < 3) {
+		fprintf(stderr, "Usage: alias <name> <command>\n");
+		return UNKNOWN;
+	}
+	// "alias ll ls -l" and "alias ll 'ls -l'" define the same body
+	size_t len = 0;
+	for (int i = 2; i < ARGC(command); ++i)
+		len += strlen(command->args[i]) + 1;
+	char *body = arena_alloc(command->arena, len);
+	char *end = body;
+	for (int i = 2; i < ARGC(command); ++i)
+		end += sprintf(end, i > 2 ? " %s" : "%s", command->args[i]);
+	add_alias(command->args[1], body);
+	return SUCCESS;
+}
+
+/**
+ * Looks up the job named by the first argument of a job builtin, the
+ * current job if there is none.
+ * @return The job, or NULL after printing an error.
+ */
+static Job *job_argument(struct command_t *command) {
+	const char *spec = ARGC(command) > 1 ? command->args[1] : "%%";
+	Job *job = jobs_find(spec);
+	if (!job)
+		fprintf(stderr, "-%s: %s: %s: no such job\n", sysname, command->name,
+				spec);
+	return job;
+}
+
+static int builtin_bg(struct command_t *command) {
+	Job *job = job_argument(command);
+	if (!job)
+		return UNKNOWN;
+	jobs_background(job);
+	return SUCCESS;
+}
+
+static int builtin_cd(struct command_t *command) {
+	const char *path = ARGC(command) > 1 ? command->args[1] : getenv("HOME");
+	if (path && chdir(path) == -1) {
+		printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
+	} else if (path) {
+		prompt_chdir();
+	}
+	return SUCCESS;
+}
+
+static int builtin_dirsize(struct command_t *command) {
+	DirSizeOptions options = { .path = ".", .recursive = 0 };
+	int foundPath = 0;
+
+	for (int i = 1; i < ARGC(command); ++i) {
+		if (strcmp(command->args[i], "-r") == 0) {
+			options.recursive = 1;
+		} else if (strcmp(command->args[i], "-x") == 0) {
+			options.one_filesystem = 1;
+		} else if (strcmp(command->args[i], "-j") == 0 && i + 1 < ARGC(command)) {
+			options.threads = atoi(command->args[++i]);
+		} else if (strcmp(command->args[i], "-t") == 0 && i + 1 < ARGC(command)) {
+			options.top = atoi(command->args[++i]);
+		} else if (strcmp(command->args[i], "-d") == 0 && i + 1 < ARGC(command)) {
+			options.max_depth = atoi(command->args[++i]);
+		} else if (strcmp(command->args[i], "-u") == 0) {
+			options.io_uring = 1;
+		} else if (strcmp(command->args[i], "-c") == 0) {
+			const char *home = getenv("HOME");
+			size_t size = strlen(home ? home : ".") + sizeof(DIRSIZE_CACHE_FILE) + 1;
+			char *cache_path = arena_alloc(command->arena, size);
+			snprintf(cache_path, size, "%s/" DIRSIZE_CACHE_FILE, home ? home : ".");
+			options.cache_path = cache_path;
+		} else {
+			if (foundPath) {
+				fprintf(stderr, "Usage: dirsize [-rxcu] [-j threads] [-t top] [-d depth] [path]\n");
+				return UNKNOWN;
+			}
+			options.path = command->args[i];
+			foundPath = 1;
+		}
+	}
+
+	if (calculate_dir_size(&options) == -1) {
+		return UNKNOWN;
+	}
+	return SUCCESS;
+}
+
+static int builtin_exit(struct command_t *command) {
+	(void)command;
+	return EXIT;
+}
+
+static int builtin_fg(struct command_t *command) {
+	Job *job = job_argument(command);
+	if (!job)
+		return UNKNOWN;
+	jobs_foreground(job);
+	return SUCCESS;
+}
+
+/**
+ * Appends a pattern to a findstringinall pattern list in the command's
+ * arena, doubling the list when it is full.
+ */
+static void append_pattern(struct command_t *command, const char ***patterns,
+						   size_t *count, size_t *capacity,
+						   const char *pattern) {
+	if (*count == *capacity) {
+		*capacity = *capacity ? *capacity * 2 : 8;
+		const char **grown =
+			arena_alloc(command->arena, sizeof(char *) * *capacity);
+		if (*count)
+			memcpy(grown, *patterns, sizeof(char *) * *count);
+		*patterns = grown;
+	}
+	(*patterns)[(*count)++] = pattern;
+}
+
+// This custom command finds the first occurence of a string in all ".txt"
+// files in the current directory. If the given string is found in the txt
+// file, it returns the line number. If not, returns "not found" string.
+// -a lists every matching line instead, -j sets the number of threads.
+// --index builds or updates the trigram index of the directory, which
+// later searches use to skip files that cannot match.
+// -e adds a pattern and -f a file of patterns, one per line, which are all
+// searched in one pass. -E makes the patterns regular expressions.
+static int builtin_findstringinall(struct command_t *command) {
+	FindStringOptions options = { .path = "." };
+	const char **patterns = NULL;
+	size_t capacity = 0;
+	int i = 1;
+	for (; i < ARGC(command) && command->args[i][0] == '-'; ++i) {
+		if (strcmp(command->args[i], "--index") == 0) {
+			options.build_index = true;
+		} else if (strcmp(command->args[i], "-E") == 0) {
+			options.regex = true;
+		} else if (strcmp(command->args[i], "-e") == 0 &&
+				   i + 1 < ARGC(command)) {
+			append_pattern(command, &patterns, &options.pattern_count,
+						   &capacity, command->args[++i]);
+		} else if (strcmp(command->args[i], "-f") == 0 &&
+				   i + 1 < ARGC(command)) {
+			FILE *file = fopen(command->args[++i], "r");
+			if (!file) {
+				fprintf(stderr, "-%s: %s: %s: %s\n", sysname, command->name,
+						command->args[i], strerror(errno));
+				return UNKNOWN;
+			}
+			char *line = NULL;
+			size_t size = 0;
+			ssize_t len;
+			while ((len = getline(&line, &size, file)) != -1) {
+				if (len > 0 && line[len - 1] == '\n')
+					line[--len] = 0;
+				if (len == 0)
+					continue;
+				append_pattern(command, &patterns, &options.pattern_count,
+							   &capacity,
+							   arena_strndup(command->arena, line, len));
+			}
+			free(line);
+			fclose(file);
+		} else if (strcmp(command->args[i], "-a") == 0) {
+			options.all_matches = true;
+		} else if (strcmp(command->args[i], "-j") == 0 &&
+				   i + 1 < ARGC(command)) {
+			options.threads = atoi(command->args[++i]);
+		} else {
+			break;
+		}
+	}
+	if (options.build_index) {
+		if (i < ARGC(command)) {
+			options.path = command->args[i];
+		}
+	} else if (options.pattern_count == 0 && i >= ARGC(command)) {
+		printf("This command needs an string to search as an argument.\n");
+		return SUCCESS;
+	} else if (options.pattern_count == 0) {
+		options.pattern = command->args[i];
+		// a single regular expression still goes through the DFA
+		if (options.regex) {
+			append_pattern(command, &patterns, &options.pattern_count,
+						   &capacity, options.pattern);
+		}
+	}
+	options.patterns = patterns;
+
+	if (find_string(&options) == -1) {
+		return UNKNOWN;
+	}
+	return SUCCESS;
+}
+
+static int builtin_good_morning(struct command_t *command) {
+	if (ARGC(command) != 3) {
+		fprintf(stderr, "Usage: good_morning <minutes> <path/to/audio>\n");
+		return UNKNOWN;
+	}
+
+	GoodMorningConfig gm_config;
+	gm_config.minutes = atoi(command->args[1]);
+	gm_config.audio_path = command->args[2];
+
+	if (gm_config.minutes <= 0) {
+		fprintf(stderr, "Invalid number of minutes. Must be greater than 0.\n");
+		return UNKNOWN;
+	}
+
+	schedule_audio_playback(&gm_config);
+	printf("Alarm set for %d minutes from now.\n", gm_config.minutes);
+	return SUCCESS;
+}
+
+static int builtin_hash(struct command_t *command) {
+	if (ARGC(command) == 1) {
+		pathcache_print();
+		return SUCCESS;
+	}
+
+	if (strcmp(command->args[1], "-r") == 0) {
+		pathcache_flush();
+		return SUCCESS;
+	}
+
+	// remember the given commands, like bash's "hash name..."
+	int code = SUCCESS;
+	for (int i = 1; i < ARGC(command); ++i) {
+		if (!pathcache_lookup(command->args[i])) {
+			fprintf(stderr, "-%s: hash: %s: not found\n", sysname,
+					command->args[i]);
+			code = UNKNOWN;
+		}
+	}
+	return code;
+}
+
+static int builtin_hexdump(struct command_t *command) {
+	// Parse arguments and set up the config structure
+	HexdumpConfig config;
+	config.group_size = 1; // Default group size
+	config.filename = NULL; // Default to NULL (STDIN)
+	config.ascii = 0;
+	config.offset = 0;
+	config.length = -1; // Default to the end of the file
+	config.threads = 0;
+
+	// Check for the presence of '-g' option and filename
+	for (int i = 1; i < ARGC(command); i++) {
+		if (strcmp(command->args[i], "-a") == 0) {
+			config.ascii = 1;
+		} else if (strcmp(command->args[i], "-s") == 0 && i + 1 < ARGC(command)) {
+			config.offset = strtoul(command->args[++i], NULL, 0);
+		} else if (strcmp(command->args[i], "-n") == 0 && i + 1 < ARGC(command)) {
+			config.length = strtoll(command->args[++i], NULL, 0);
+		} else if (strcmp(command->args[i], "-j") == 0 && i + 1 < ARGC(command)) {
+			config.threads = atoi(command->args[++i]);
+		} else if (strcmp(command->args[i], "-g") == 0 && i + 1 < ARGC(command)) {
+			config.group_size = atoi(command->args[++i]);
+			if (config.group_size <= 0 || config.group_size > 16 ||
+				(config.group_size & (config.group_size - 1)) != 0) {
+				fprintf(stderr, "Invalid group size. Must be a power of 2 "
+								"and not larger than 16.\n");
+				return UNKNOWN;
+			}
+		} else {
+			config.filename = command->args[i]; // the last one is the file
+		}
+	}
+
+	hexdump(&config);
+	return SUCCESS;
+}
+
+static int builtin_jobs(struct command_t *command) {
+	(void)command;
+	jobs_print();
+	return SUCCESS;
+}
+
+// Signals kill accepts by name, without the SIG prefix
+static const struct {
+	const char *name;
+	int number;
+} signal_names[] = {
+	{ "HUP", SIGHUP },	 { "INT", SIGINT },	  { "QUIT", SIGQUIT },
+	{ "KILL", SIGKILL }, { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 },
+	{ "PIPE", SIGPIPE }, { "ALRM", SIGALRM }, { "TERM", SIGTERM },
+	{ "CONT", SIGCONT }, { "STOP", SIGSTOP }, { "TSTP", SIGTSTP },
+	{ "TTIN", SIGTTIN }, { "TTOU", SIGTTOU }, { "WINCH", SIGWINCH },
+};
+
+/**
+ * Parses a signal given as a number or a name, with or without "SIG".
+ * @return The signal number, or -1 if it is not known.
+ */
+static int parse_signal(const char *name) {
+	char *end;
+	long number = strtol(name, &end, 10);
+	if (*name && !*end)
+		return number > 0 && number < NSIG ? number : -1;
+	if (strncasecmp(name, "SIG", 3) == 0)
+		name += 3;
+	for (size_t i = 0; i < sizeof(signal_names) / sizeof(signal_names[0]); ++i)
+		if (strcasecmp(name, signal_names[i].name) == 0)
+			return signal_names[i].number;
+	return -1;
+}
+
+static int builtin_kill(struct command_t *command) {
+	int sig = SIGTERM;
+	int i = 1;
+	if (i + 1 < ARGC(command) && strcmp(command->args[i], "-s") == 0) {
+		sig = parse_signal(command->args[i + 1]);
+		i += 2;
+	} else if (i < ARGC(command) && command->args[i][0] == '-' &&
+			   command->args[i][1]) {
+		sig = parse_signal(command->args[i] + 1);
+		i++;
+	}
+	if (sig == -1 || i >= ARGC(command)) {
+		fprintf(stderr, "Usage: kill [-s signal | -signal] %%job | pid ...\n");
+		return UNKNOWN;
+	}
+
+	int result = SUCCESS;
+	for (; i < ARGC(command); ++i) {
+		const char *target = command->args[i];
+		int failed;
+		if (target[0] == '%') {
+			Job *job = jobs_find(target);
+			if (!job) {
+				fprintf(stderr, "-%s: kill: %s: no such job\n", sysname,
+						target);
+				result = UNKNOWN;
+				continue;
+			}
+			failed = jobs_signal(job, sig) == -1;
+		} else {
+			char *end;
+			long pid = strtol(target, &end, 10);
+			if (!*target || *end) {
+				fprintf(stderr, "-%s: kill: %s: not a pid or job\n", sysname,
+						target);
+				result = UNKNOWN;
+				continue;
+			}
+			failed = kill(pid, sig) == -1;
+		}
+		if (failed) {
+			fprintf(stderr, "-%s: kill: %s: %s\n", sysname, target,
+					strerror(errno));
+			result = UNKNOWN;
+		}
+	}
+	// a job killed here is reported before the next prompt
+	return result;
+}
+
+static int builtin_parallel(struct command_t *command) {
+	ParallelOptions options = { 0 };
+	int i = 1;
+	for (; i < ARGC(command) && command->args[i][0] == '-'; ++i) {
+		if (strcmp(command->args[i], "-j") == 0 && i + 1 < ARGC(command)) {
+			options.jobs = atoi(command->args[++i]);
+		} else if (strcmp(command->args[i], "-k") == 0) {
+			options.keep_order = true;
+		} else {
+			break;
+		}
+	}
+
+	// the template runs up to ":::", the inputs follow it
+	int separator = i;
+	while (separator < ARGC(command) &&
+		   strcmp(command->args[separator], ":::") != 0)
+		separator++;
+	if (separator == i) {
+		fprintf(stderr, "Usage: parallel [-j jobs] [-k] command [args] "
+						"[::: inputs]\n");
+		return UNKNOWN;
+	}
+
+	struct command_t template = *command;
+	template.name = command->args[i];
+	template.args = command->args + i;
+	template.arg_count = separator - i + 1;
+	// the redirects were applied to the builtin itself
+	memset(template.redirects, 0, sizeof(template.redirects));
+	template.next = NULL;
+	options.command = &template;
+
+	char **lines = NULL;
+	if (separator < ARGC(command)) {
+		options.inputs = command->args + separator + 1;
+		options.input_count = ARGC(command) - separator - 1;
+	} else {
+		// one input per line of stdin
+		size_t capacity = 0;
+		char *line = NULL;
+		size_t line_size = 0;
+		ssize_t len;
+		while ((len = getline(&line, &line_size, stdin)) != -1) {
+			if (len > 0 && line[len - 1] == '\n')
+				line[--len] = '\0';
+			if (len == 0)
+				continue;
+			if (options.input_count == capacity) {
+				capacity = capacity ? capacity * 2 : 64;
+				lines = realloc(lines, capacity * sizeof(char *));
+			}
+			lines[options.input_count++] = arena_strdup(command->arena, line);
+		}
+		free(line);
+		clearerr(stdin);
+		options.inputs = lines;
+		options.inputs_from_stdin = true;
+	}
+
+	int failed = run_parallel(&options);
+	free(lines);
+	return failed == 0 ? SUCCESS : UNKNOWN;
+}
+
+static int builtin_pipestatus(struct command_t *command) {
+	(void)command;
+	print_pipeline_status(&last_pipeline);
+	return SUCCESS;
+}
+
+static int builtin_wait(struct command_t *command) {
+	if (ARGC(command) < 2) {
+		jobs_wait(NULL);
+		return SUCCESS;
+	}
+	int result = SUCCESS;
+	for (int i = 1; i < ARGC(command); ++i) {
+		Job *job = jobs_find(command->args[i]);
+		if (!job) {
+			fprintf(stderr, "-%s: wait: %s: no such job\n", sysname,
+					command->args[i]);
+			result = UNKNOWN;
+			continue;
+		}
+		jobs_wait(job);
+	}
+	return result;
+}
+
+// Must stay sorted by name, find_builtin does a binary search
+static const Builtin builtins[] = {
+	{ "alias", builtin_alias },
+	{ "bg", builtin_bg },
+	{ "cd", builtin_cd },
+	{ "dirsize", builtin_dirsize },
+	{ "exit", builtin_exit },
+	{ "fg", builtin_fg },
+	{ "findstringinall", builtin_findstringinall },
+	{ "good_morning", builtin_good_morning },
+	{ "hash", builtin_hash },
+	{ "hexdump", builtin_hexdump },
+	{ "jobs", builtin_jobs },
+	{ "kill", builtin_kill },
+	{ "parallel", builtin_parallel },
+	{ "pipestatus", builtin_pipestatus },
+	{ "wait", builtin_wait },
+};
+
+static int compare_builtin(const void *key, const void *element) {
+	return strcmp(key, ((const Builtin *)element)->name);
+}
+
+const Builtin *find_builtin(const char *name) {
+	return bsearch(name, builtins, sizeof(builtins) / sizeof(builtins[0]),
+				   sizeof(builtins[0]), compare_builtin);
+}
+
+void list_builtins(void (*callback)(const char *name, void *data),
+				   void *data) {
+	for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); ++i)
+		callback(builtins[i].name, data);
+}
+
+int run_builtin(const Builtin *builtin, struct command_t *command) {
+	bool redirected = command->redirects[0] || command->redirects[1] ||
+					  command->redirects[2];
+	int saved_stdin = -1, saved_stdout = -1;
+
+	if (redirected) {
+		fflush(stdout);
+		// keep the shell's own fds out of the way of the command's
+		saved_stdin = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+		saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+		if (apply_redirects(command) == -1) {
+			dup2(saved_stdin, STDIN_FILENO);
+			dup2(saved_stdout, STDOUT_FILENO);
+			close(saved_stdin);
+			close(saved_stdout);
+			return UNKNOWN;
+		}
+	}
+
+	int code = builtin->handler(command);
+
+	if (redirected) {
+		fflush(stdout);
+		dup2(saved_stdin, STDIN_FILENO);
+		dup2(saved_stdout, STDOUT_FILENO);
+		close(saved_stdin);
+		close(saved_stdout);
+	}
+	return code;
+}
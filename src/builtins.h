@@ -0,0 +1,35 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include "shell.h"
+
+typedef int (*builtin_handler)(struct command_t *command);
+
+typedef struct {
+	const char *name; // Name the builtin is invoked with
+	builtin_handler handler; // Returns one of enum return_codes
+} Builtin;
+
+/**
+ * Looks a command name up in the builtin table.
+ * @param name Command name.
+ * @return The builtin, or NULL if name is not a builtin.
+ */
+const Builtin *find_builtin(const char *name);
+
+/**
+ * Calls callback with the name of every builtin, in sorted order.
+ */
+void list_builtins(void (*callback)(const char *name, void *data),
+				   void *data);
+
+/**
+ * Runs a builtin inside the shell process. Redirects of the command are
+ * applied to the shell's own stdin/stdout and restored afterwards.
+ * @param builtin Builtin returned by find_builtin.
+ * @param command Command to run.
+ * @return The handler's return code.
+ */
+int run_builtin(const Builtin *builtin, struct command_t *command);
+
+#endif // BUILTINS_H
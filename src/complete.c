@@ -0,0 +1,386 @@
+#define _GNU_SOURCE
+#include "complete.h"
+#include "alias.h"
+#include "builtins.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Directories whose listings are kept for path completion
+#define COMPLETE_CACHED_DIRS 16
+
+// Trie node, children are a sibling list kept sorted by character
+typedef struct {
+	uint32_t first_child; // 0 for none, the root is never a child
+	uint32_t next_sibling;
+	char c;
+	bool terminal; // a name ends here
+} TrieNode;
+
+typedef struct {
+	char *path;
+	struct timespec mtime;
+} WatchedDir;
+
+typedef struct {
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	char **names; // sorted
+	unsigned char *types; // d_type of each name
+	size_t count;
+	unsigned long last_used;
+} DirListing;
+
+static TrieNode *trie;
+static uint32_t trie_count, trie_capacity;
+
+static char *trie_path; // PATH the trie was built from
+static WatchedDir *watched;
+static int watched_count;
+
+static DirListing listings[COMPLETE_CACHED_DIRS];
+static unsigned long listing_clock;
+
+static void add_match(Completion *completion, const char *match, size_t len) {
+	if (completion->count == completion->capacity) {
+		completion->capacity = completion->capacity ? completion->capacity * 2
+													: 16;
+		completion->matches = realloc(completion->matches,
+									  completion->capacity * sizeof(char *));
+	}
+	completion->matches[completion->count++] = strndup(match, len);
+}
+
+static uint32_t new_node(char c) {
+	if (trie_count == trie_capacity) {
+		trie_capacity = trie_capacity ? trie_capacity * 2 : 4096;
+		trie = realloc(trie, trie_capacity * sizeof(TrieNode));
+	}
+	trie[trie_count] = (TrieNode){ 0, 0, c, false };
+	return trie_count++;
+}
+
+static void trie_insert(const char *name) {
+	uint32_t node = 0;
+	for (; *name; ++name) {
+		// find the child for *name, or the sibling it goes after
+		uint32_t previous = 0, child = trie[node].first_child;
+		while (child && (unsigned char)trie[child].c < (unsigned char)*name) {
+			previous = child;
+			child = trie[child].next_sibling;
+		}
+		if (!child || trie[child].c != *name) {
+			uint32_t inserted = new_node(*name);
+			trie[inserted].next_sibling = child;
+			if (previous)
+				trie[previous].next_sibling = inserted;
+			else
+				trie[node].first_child = inserted;
+			child = inserted;
+		}
+		node = child;
+	}
+	trie[node].terminal = true;
+}
+
+/**
+ * Adds every name below node, in sorted order. prefix holds the path from
+ * the root and has room for any name.
+ */
+static void trie_collect(uint32_t node, char *prefix, size_t len,
+						 Completion *completion) {
+	if (trie[node].terminal)
+		add_match(completion, prefix, len);
+	for (uint32_t child = trie[node].first_child; child;
+		 child = trie[child].next_sibling) {
+		prefix[len] = trie[child].c;
+		trie_collect(child, prefix, len + 1, completion);
+	}
+}
+
+static bool path_changed(const char *path) {
+	if (!trie_path || strcmp(trie_path, path) != 0)
+		return true;
+	for (int i = 0; i < watched_count; ++i) {
+		struct stat st;
+		if (stat(watched[i].path, &st) == -1)
+			st.st_mtim = (struct timespec){ 0, 0 };
+		if (st.st_mtim.tv_sec != watched[i].mtime.tv_sec ||
+			st.st_mtim.tv_nsec != watched[i].mtime.tv_nsec)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Rebuilds the trie of executables if PATH or one of its directories
+ * changed since the last build.
+ */
+static void update_trie() {
+	const char *path = getenv("PATH");
+	if (!path)
+		path = "/bin:/usr/bin";
+	if (trie && !path_changed(path))
+		return;
+
+	for (int i = 0; i < watched_count; ++i)
+		free(watched[i].path);
+	free(watched);
+	free(trie_path);
+	trie_path = strdup(path);
+	watched = NULL;
+	watched_count = 0;
+	trie_count = 0;
+	new_node(0); // root
+
+	char *copy = strdup(path), *saveptr = NULL;
+	for (char *dir = strtok_r(copy, ":", &saveptr); dir;
+		 dir = strtok_r(NULL, ":", &saveptr)) {
+		watched = realloc(watched, (watched_count + 1) * sizeof(WatchedDir));
+		WatchedDir *w = &watched[watched_count++];
+		w->path = strdup(dir);
+		w->mtime = (struct timespec){ 0, 0 };
+
+		// take the mtime before reading, a change while reading then
+		// shows up on the next completion
+		int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		struct stat st;
+		if (dir_fd == -1 || fstat(dir_fd, &st) == -1) {
+			if (dir_fd != -1)
+				close(dir_fd);
+			continue;
+		}
+		w->mtime = st.st_mtim;
+
+		DIR *dp = fdopendir(dir_fd);
+		struct dirent *entry;
+		while ((entry = readdir(dp))) {
+			if (entry->d_name[0] == '.' || entry->d_type == DT_DIR)
+				continue;
+			if (faccessat(dir_fd, entry->d_name, X_OK, 0) == 0)
+				trie_insert(entry->d_name);
+		}
+		closedir(dp);
+	}
+	free(copy);
+}
+
+typedef struct {
+	const char *prefix;
+	size_t len;
+	Completion *completion;
+} PrefixFilter;
+
+static void add_if_prefixed(const char *name, void *data) {
+	PrefixFilter *filter = data;
+	if (strncmp(name, filter->prefix, filter->len) == 0)
+		add_match(filter->completion, name, strlen(name));
+}
+
+static int compare_names(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void complete_command(const char *word, Completion *completion) {
+	PrefixFilter filter = { word, strlen(word), completion };
+	list_builtins(add_if_prefixed, &filter);
+	list_aliases(add_if_prefixed, &filter);
+
+	update_trie();
+	uint32_t node = 0;
+	for (const char *p = word; *p && node != UINT32_MAX; ++p) {
+		uint32_t child = trie[node].first_child;
+		while (child && trie[child].c != *p)
+			child = trie[child].next_sibling;
+		node = child ? child : UINT32_MAX;
+	}
+	if (node != UINT32_MAX) {
+		char prefix[4096];
+		size_t len = strlen(word);
+		if (len < sizeof(prefix) - 256) {
+			memcpy(prefix, word, len);
+			trie_collect(node, prefix, len, completion);
+		}
+	}
+
+	// builtins and aliases can shadow executables of the same name
+	qsort(completion->matches, completion->count, sizeof(char *),
+		  compare_names);
+	size_t kept = 0;
+	for (size_t i = 0; i < completion->count; ++i) {
+		if (kept && strcmp(completion->matches[kept - 1],
+						   completion->matches[i]) == 0)
+			free(completion->matches[i]);
+		else
+			completion->matches[kept++] = completion->matches[i];
+	}
+	completion->count = kept;
+}
+
+static void free_listing(DirListing *listing) {
+	for (size_t i = 0; i < listing->count; ++i)
+		free(listing->names[i]);
+	free(listing->names);
+	free(listing->types);
+	memset(listing, 0, sizeof(*listing));
+}
+
+static int compare_entries(const void *a, const void *b, void *names) {
+	return strcmp(((char **)names)[*(const size_t *)a],
+				  ((char **)names)[*(const size_t *)b]);
+}
+
+/**
+ * Returns the sorted listing of a directory, read again only if its mtime
+ * changed. Directories are keyed by device and inode, so the same one
+ * reached through different paths or after a cd is read once.
+ */
+static DirListing *get_listing(const char *dir) {
+	int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	struct stat st;
+	if (dir_fd == -1)
+		return NULL;
+	if (fstat(dir_fd, &st) == -1) {
+		close(dir_fd);
+		return NULL;
+	}
+
+	DirListing *listing = &listings[0];
+	for (int i = 0; i < COMPLETE_CACHED_DIRS; ++i) {
+		if (listings[i].names && listings[i].dev == st.st_dev &&
+			listings[i].ino == st.st_ino) {
+			listing = &listings[i];
+			break;
+		}
+		// otherwise reuse the least recently used slot
+		if (listings[i].last_used < listing->last_used)
+			listing = &listings[i];
+	}
+	listing->last_used = ++listing_clock;
+
+	if (listing->names && listing->dev == st.st_dev &&
+		listing->ino == st.st_ino &&
+		listing->mtime.tv_sec == st.st_mtim.tv_sec &&
+		listing->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+		close(dir_fd);
+		return listing;
+	}
+
+	free_listing(listing);
+	listing->dev = st.st_dev;
+	listing->ino = st.st_ino;
+	listing->mtime = st.st_mtim;
+	listing->last_used = listing_clock;
+
+	size_t capacity = 0;
+	char **names = NULL;
+	unsigned char *types = NULL;
+	DIR *dp = fdopendir(dir_fd);
+	struct dirent *entry;
+	while ((entry = readdir(dp))) {
+		if (strcmp(entry->d_name, ".") == 0 ||
+			strcmp(entry->d_name, "..") == 0)
+			continue;
+		if (listing->count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			names = realloc(names, capacity * sizeof(char *));
+			types = realloc(types, capacity);
+		}
+		names[listing->count] = strdup(entry->d_name);
+		types[listing->count++] = entry->d_type;
+	}
+	closedir(dp);
+
+	// sort names and types together through an index
+	size_t *order = malloc(listing->count * sizeof(size_t));
+	for (size_t i = 0; i < listing->count; ++i)
+		order[i] = i;
+	qsort_r(order, listing->count, sizeof(size_t), compare_entries, names);
+	listing->names = malloc((listing->count + 1) * sizeof(char *));
+	listing->types = malloc(listing->count + 1);
+	for (size_t i = 0; i < listing->count; ++i) {
+		listing->names[i] = names[order[i]];
+		listing->types[i] = types[order[i]];
+	}
+	free(order);
+	free(names);
+	free(types);
+	return listing;
+}
+
+static void complete_path(const char *word, Completion *completion) {
+	const char *slash = strrchr(word, '/');
+	const char *base = slash ? slash + 1 : word;
+	size_t dir_len = slash ? (size_t)(slash - word) + 1 : 0;
+	size_t base_len = strlen(base);
+
+	char dir[4096];
+	if (dir_len >= sizeof(dir))
+		return;
+	if (dir_len) {
+		memcpy(dir, word, dir_len);
+		dir[dir_len] = 0;
+	} else {
+		strcpy(dir, ".");
+	}
+
+	DirListing *listing = get_listing(dir);
+	if (!listing)
+		return;
+
+	// binary search for the first name not below the prefix
+	size_t low = 0, high = listing->count;
+	while (low < high) {
+		size_t mid = (low + high) / 2;
+		if (strncmp(listing->names[mid], base, base_len) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	char match[8192];
+	for (size_t i = low; i < listing->count &&
+						 strncmp(listing->names[i], base, base_len) == 0;
+		 ++i) {
+		const char *name = listing->names[i];
+		// hidden files only when asked for
+		if (name[0] == '.' && base[0] != '.')
+			continue;
+
+		bool is_dir = listing->types[i] == DT_DIR;
+		if (listing->types[i] == DT_UNKNOWN || listing->types[i] == DT_LNK) {
+			struct stat st;
+			snprintf(match, sizeof(match), "%s%s", dir_len ? dir : "", name);
+			is_dir = stat(match, &st) == 0 && S_ISDIR(st.st_mode);
+		}
+
+		int len = snprintf(match, sizeof(match), "%.*s%s%s", (int)dir_len,
+						   word, name, is_dir ? "/" : "");
+		if (len > 0 && len < (int)sizeof(match))
+			add_match(completion, match, len);
+	}
+}
+
+void complete_word(const char *word, bool command, Completion *completion) {
+	completion->matches = NULL;
+	completion->count = completion->capacity = 0;
+
+	if (command && !strchr(word, '/'))
+		complete_command(word, completion);
+	else
+		complete_path(word, completion);
+}
+
+void free_completion(Completion *completion) {
+	for (size_t i = 0; i < completion->count; ++i)
+		free(completion->matches[i]);
+	free(completion->matches);
+	completion->matches = NULL;
+	completion->count = completion->capacity = 0;
+}
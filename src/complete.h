@@ -0,0 +1,27 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+	char **matches; // Sorted candidates that start with the word
+	size_t count;
+	size_t capacity;
+} Completion;
+
+/**
+ * Finds the completions of a word. Command names come from a prefix trie
+ * of the executables in $PATH, which is built on first use and rebuilt
+ * when PATH or the mtime of one of its directories changes, plus the
+ * builtins and aliases. Paths come from a per-directory cache of sorted
+ * readdir results that is also refreshed by mtime. Directories end in '/'.
+ * @param word Word to complete, without quoting.
+ * @param command true if the word is in command position.
+ * @param completion Receives the candidates, release with free_completion.
+ */
+void complete_word(const char *word, bool command, Completion *completion);
+
+void free_completion(Completion *completion);
+
+#endif // COMPLETE_H
@@ -1,79 +1,1069 @@
+#define _GNU_SOURCE
 #include "dirsize.h"
+#include "dirsizecache.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/stat.h>
-#include <dirent.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
-long calculate_directory_size(const char *base_path, int recursive) {
-    long total_size = 0;
-    DIR *dir = opendir(base_path);
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define DIRSIZE_HAVE_IO_URING
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
+
+// Shards of the hard link set, each with its own lock
+#define LINK_SHARDS 64
+
+// A directory being walked. It stays allocated until its whole subtree is
+// done, and its fd stays open until every subdirectory has been opened
+// relative to it.
+typedef struct DirNode {
+    struct DirNode *parent;
+    int depth;              // 0 for the root
+    DIR *dir;
+    atomic_int fd_users;    // The listing and the subdirectories not yet opened
+    atomic_int pending;     // The listing and the subdirectories not yet done
+    atomic_ullong bytes;    // Totals of the subtree
+    atomic_ullong files;
+
+    // Used only by the thread listing the directory
+    struct stat self;
+    const DirSizeCacheEntry *cached;    // Its files, if the cache is current
+    bool recordable;                    // Whether to store it in the cache
+    unsigned long long listed_bytes;    // Files counted in this directory
+    unsigned long long listed_files;
+    unsigned long long own_bytes;       // Of those, the files with one link
+    unsigned long long own_files;
+    DirSizeCacheLink *links;            // And the files with several
+    size_t link_count, link_capacity;
+    size_t stats_pending;               // The listing and its statx calls in flight
+
+    char name[];            // Relative to the parent, or the root path
+} DirNode;
+
+// Queue of directories owned by one thread. The owner pushes and pops at
+// the tail, depth first, and thieves take from the head, where the
+// directories closest to the root and so the largest subtrees are.
+typedef struct {
+    pthread_mutex_t lock;
+    DirNode **nodes;
+    size_t head, count, capacity;
+} TaskQueue;
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+} LinkKey;
+
+typedef struct {
+    pthread_mutex_t lock;
+    LinkKey *keys;
+    size_t count, capacity;
+} LinkShard;
+
+// The largest entries seen so far, a min-heap of at most options->top
+typedef struct {
+    pthread_mutex_t lock;
+    DirSizeEntry *entries;
+    size_t count;
+    atomic_ullong floor;    // Smallest size kept, once the heap is full
+} TopHeap;
+
+typedef struct {
+    const DirSizeOptions *options;
+    dev_t root_dev;
+    int worker_count;
+    TaskQueue *queues;
+    atomic_long outstanding;    // Directories queued or being read
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;   // Signalled when work is queued or the walk ends
+    atomic_int idle;            // Workers waiting on idle_cond
+    LinkShard links[LINK_SHARDS];
+    atomic_ullong directories;
+    atomic_ullong errors;
+    const DirSizeCache *cache;      // NULL when no cache file is used
+    DirSizeCacheRecords *records;   // Directories read, per thread
+    time_t started;
+    atomic_ullong cached_directories;
+    atomic_ullong cached_bytes;
+    TopHeap top_directories;
+    TopHeap top_files;
+    DirSizeResult result;       // Filled in when the root is done
+} Walk;
+
+typedef struct {
+    Walk *walk;
+    int index;
+} Worker;
+
+static void push_task(TaskQueue *queue, DirNode *node) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count == queue->capacity) {
+        size_t capacity = queue->capacity ? queue->capacity * 2 : 64;
+        DirNode **nodes = malloc(capacity * sizeof(DirNode *));
+        for (size_t i = 0; i < queue->count; ++i) {
+            nodes[i] = queue->nodes[(queue->head + i) % queue->capacity];
+        }
+        free(queue->nodes);
+        queue->nodes = nodes;
+        queue->head = 0;
+        queue->capacity = capacity;
+    }
+    queue->nodes[(queue->head + queue->count++) % queue->capacity] = node;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Wakes a parked worker after a push, or all of them once the walk is
+ * done. The lock orders this against a worker that is about to park.
+ */
+static void wake_idle(Walk *walk, bool all) {
+    if (atomic_load(&walk->idle) == 0) {
+        return;
+    }
+    pthread_mutex_lock(&walk->idle_lock);
+    if (all) {
+        pthread_cond_broadcast(&walk->idle_cond);
+    } else {
+        pthread_cond_signal(&walk->idle_cond);
+    }
+    pthread_mutex_unlock(&walk->idle_lock);
+}
+
+static DirNode *pop_task(TaskQueue *queue, bool steal) {
+    DirNode *node = NULL;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count > 0) {
+        if (steal) {
+            node = queue->nodes[queue->head];
+            queue->head = (queue->head + 1) % queue->capacity;
+        } else {
+            node = queue->nodes[(queue->head + queue->count - 1) % queue->capacity];
+        }
+        queue->count--;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return node;
+}
+
+/**
+ * Records an inode with several links.
+ * @return true the first time the inode is seen.
+ */
+static bool first_link(Walk *walk, dev_t dev, ino_t ino) {
+    size_t hash = (ino * 0x9E3779B97F4A7C15ULL) ^ dev;
+    LinkShard *shard = &walk->links[hash % LINK_SHARDS];
+    hash /= LINK_SHARDS;
+
+    pthread_mutex_lock(&shard->lock);
+    if ((shard->count + 1) * 2 > shard->capacity) {
+        size_t capacity = shard->capacity ? shard->capacity * 2 : 256;
+        LinkKey *keys = calloc(capacity, sizeof(LinkKey));
+        for (size_t i = 0; i < shard->capacity; ++i) {
+            if (shard->keys[i].ino == 0) {
+                continue;
+            }
+            size_t old = (shard->keys[i].ino * 0x9E3779B97F4A7C15ULL) ^ shard->keys[i].dev;
+            size_t slot = (old / LINK_SHARDS) & (capacity - 1);
+            while (keys[slot].ino != 0) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            keys[slot] = shard->keys[i];
+        }
+        free(shard->keys);
+        shard->keys = keys;
+        shard->capacity = capacity;
+    }
+
+    bool first = true;
+    size_t slot = hash & (shard->capacity - 1);
+    for (; shard->keys[slot].ino != 0; slot = (slot + 1) & (shard->capacity - 1)) {
+        if (shard->keys[slot].ino == ino && shard->keys[slot].dev == dev) {
+            first = false;
+            break;
+        }
+    }
+    if (first) {
+        shard->keys[slot] = (LinkKey){dev, ino};
+        shard->count++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return first;
+}
+
+/**
+ * Builds the path of a directory, or of an entry in it, from the names
+ * of the directories above it, which are all still being walked.
+ */
+static char *node_path(const DirNode *node, const char *name) {
+    // a root given as "/" or "dir/" already ends with a separator
+    const DirNode *root = node;
+    while (root->parent) {
+        root = root->parent;
+    }
+    size_t root_len = strlen(root->name);
+    bool root_slash = root_len > 0 && root->name[root_len - 1] == '/';
+
+    size_t len = name ? strlen(name) + 1 : 0;
+    for (const DirNode *up = node; up; up = up->parent) {
+        len += strlen(up->name) + (up->parent ? 1 : 0);
+    }
+    if (root_slash && (name || node->parent)) {
+        len--;
+    }
+    if (!name && !node->parent) {
+        return strdup(node->name);
+    }
+    char *path = malloc(len + 1);
+    char *end = path + len;
+    *end = '\0';
+    const char *part = name ? name : node->name;
+    for (const DirNode *up = name ? node : node->parent; ; up = up->parent) {
+        end -= strlen(part);
+        memcpy(end, part, strlen(part));
+        if (up->parent || !root_slash) {
+            *--end = '/';
+        }
+        if (!up->parent) {
+            memcpy(path, up->name, root_len);
+            break;
+        }
+        part = up->name;
+    }
+    return path;
+}
+
+static void swap_entries(DirSizeEntry *a, DirSizeEntry *b) {
+    DirSizeEntry swap = *a;
+    *a = *b;
+    *b = swap;
+}
+
+/**
+ * Keeps a directory or file if it is among the largest seen so far. Its
+ * path is built only then.
+ */
+static void offer_top(Walk *walk, TopHeap *heap, unsigned long long bytes,
+                      const DirNode *node, const char *name) {
+    size_t top = walk->options->top > 0 ? walk->options->top : 0;
+    if (top == 0 || bytes <= atomic_load_explicit(&heap->floor, memory_order_relaxed)) {
+        return;
+    }
+
+    pthread_mutex_lock(&heap->lock);
+    if (heap->count < top) {
+        // sift up the new entry
+        size_t i = heap->count++;
+        heap->entries[i] = (DirSizeEntry){node_path(node, name), bytes};
+        while (i > 0 && heap->entries[(i - 1) / 2].bytes > heap->entries[i].bytes) {
+            swap_entries(&heap->entries[(i - 1) / 2], &heap->entries[i]);
+            i = (i - 1) / 2;
+        }
+    } else if (bytes > heap->entries[0].bytes) {
+        // replace the smallest and sift it down
+        free(heap->entries[0].path);
+        heap->entries[0] = (DirSizeEntry){node_path(node, name), bytes};
+        size_t i = 0;
+        for (;;) {
+            size_t smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+            if (left < top && heap->entries[left].bytes < heap->entries[smallest].bytes) {
+                smallest = left;
+            }
+            if (right < top && heap->entries[right].bytes < heap->entries[smallest].bytes) {
+                smallest = right;
+            }
+            if (smallest == i) {
+                break;
+            }
+            swap_entries(&heap->entries[i], &heap->entries[smallest]);
+            i = smallest;
+        }
+    }
+    if (heap->count == top) {
+        atomic_store_explicit(&heap->floor, heap->entries[0].bytes, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&heap->lock);
+}
+
+static int compare_largest(const void *a, const void *b) {
+    const DirSizeEntry *x = a, *y = b;
+    if (x->bytes != y->bytes) {
+        return x->bytes < y->bytes ? 1 : -1;
+    }
+    return strcmp(x->path, y->path);
+}
+
+/**
+ * Hands a heap over to the result, sorted largest first.
+ */
+static DirSizeEntry *take_top(TopHeap *heap, size_t *count) {
+    pthread_mutex_destroy(&heap->lock);
+    qsort(heap->entries, heap->count, sizeof(DirSizeEntry), compare_largest);
+    *count = heap->count;
+    return heap->entries;
+}
+
+static DirNode *new_node(DirNode *parent, const char *name) {
+    size_t len = strlen(name) + 1;
+    DirNode *node = calloc(1, sizeof(DirNode) + len);
+    node->parent = parent;
+    node->depth = parent ? parent->depth + 1 : 0;
+    atomic_init(&node->fd_users, 1);
+    atomic_init(&node->pending, 1);
+    atomic_init(&node->bytes, 0);
+    atomic_init(&node->files, 0);
+    memcpy(node->name, name, len);
+    return node;
+}
+
+static void release_fd(DirNode *node) {
+    if (atomic_fetch_sub(&node->fd_users, 1) == 1 && node->dir) {
+        closedir(node->dir);
+        node->dir = NULL;
+    }
+}
+
+/**
+ * Drops one pending item of a directory. The last one completes its
+ * subtree, whose totals are then added to the parent.
+ */
+static void finish_node(Walk *walk, DirNode *node) {
+    while (node && atomic_fetch_sub(&node->pending, 1) == 1) {
+        DirNode *parent = node->parent;
+        unsigned long long bytes = atomic_load(&node->bytes);
+        unsigned long long files = atomic_load(&node->files);
+        if (parent) {
+            atomic_fetch_add(&parent->bytes, bytes);
+            atomic_fetch_add(&parent->files, files);
+            int max_depth = walk->options->max_depth;
+            if (max_depth == 0 || node->depth <= max_depth) {
+                offer_top(walk, &walk->top_directories, bytes, node, NULL);
+            }
+        } else {
+            walk->result.bytes = bytes;
+            walk->result.files = files;
+        }
+        free(node);
+        node = parent;
+    }
+}
+
+/**
+ * Adds a file with several links, unless it was already counted.
+ * @param name The file's name, or NULL if it comes from the cache.
+ */
+static void add_link(Walk *walk, DirNode *node, dev_t dev, ino_t ino, off_t size,
+                     const char *name) {
+    if (first_link(walk, dev, ino)) {
+        node->listed_bytes += size;
+        node->listed_files++;
+        if (name) {
+            offer_top(walk, &walk->top_files, size, node, name);
+        }
+    }
+}
+
+/**
+ * Queues a subdirectory on the listing thread's queue.
+ */
+static void add_subdirectory(Walk *walk, TaskQueue *queue, DirNode *node,
+                             const char *name) {
+    atomic_fetch_add(&node->pending, 1);
+    atomic_fetch_add(&node->fd_users, 1);
+    atomic_fetch_add(&walk->outstanding, 1);
+    push_task(queue, new_node(node, name));
+    wake_idle(walk, false);
+}
+
+/**
+ * Opens a directory relative to its parent. A directory found unchanged
+ * in the cache takes its files from there.
+ * @return The directory's fd, or -1 if it could not be opened, in which
+ * case the node is already finished.
+ */
+static int open_listing(Walk *walk, DirNode *node) {
+    int parent_fd = node->parent ? dirfd(node->parent->dir) : AT_FDCWD;
+    // the root may be a symlink to the directory to walk, entries may not
+    int nofollow = node->parent ? O_NOFOLLOW : 0;
+    int fd = openat(parent_fd, node->name,
+                    O_RDONLY | O_DIRECTORY | nofollow | O_CLOEXEC);
+    if (node->parent) {
+        release_fd(node->parent);
+    }
+    if (fd == -1 || !(node->dir = fdopendir(fd))) {
+        fprintf(stderr, "Error: Unable to open directory %s\n", node->name);
+        if (fd != -1) {
+            close(fd);
+        }
+        atomic_fetch_add(&walk->errors, 1);
+        finish_node(walk, node);
+        return -1;
+    }
+    atomic_fetch_add(&walk->directories, 1);
+
+    if (walk->cache && fstat(fd, &node->self) == 0) {
+        // the largest files can only be found by looking at them
+        node->cached = walk->options->top ? NULL : dirsize_cache_find(walk->cache, &node->self);
+        if (node->cached) {
+            node->listed_bytes = node->cached->bytes;
+            node->listed_files = node->cached->files;
+            const DirSizeCacheLink *links = dirsize_cache_links(walk->cache, node->cached);
+            for (uint64_t i = 0; i < node->cached->link_count; ++i) {
+                add_link(walk, node, node->self.st_dev, links[i].inode, links[i].size, NULL);
+            }
+            atomic_fetch_add(&walk->cached_directories, 1);
+            atomic_fetch_add(&walk->cached_bytes, node->listed_bytes);
+        } else {
+            // a directory changed in the second the walk started in could
+            // change again without a new timestamp, so it is not recorded
+            node->recordable = node->self.st_ctim.tv_sec < walk->started &&
+                               node->self.st_mtim.tv_sec < walk->started;
+        }
+    }
+    return fd;
+}
+
+enum { ENTRY_SKIP, ENTRY_SUBDIRECTORY, ENTRY_STAT };
+
+/**
+ * Decides from its d_type what to do with a directory entry.
+ */
+static int classify_entry(const Walk *walk, const DirNode *node,
+                          const struct dirent *entry) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+        return ENTRY_SKIP;
+    }
+    if (entry->d_type != DT_UNKNOWN && entry->d_type != DT_REG &&
+        entry->d_type != DT_DIR) {
+        return ENTRY_SKIP; // symlinks, devices, sockets and fifos have no size
+    }
+    if (entry->d_type == DT_DIR && !walk->options->recursive) {
+        return ENTRY_SKIP;
+    }
+    if (node->cached && entry->d_type == DT_REG) {
+        return ENTRY_SKIP;
+    }
+    if (node->cached && entry->d_type == DT_DIR && !walk->options->one_filesystem) {
+        return ENTRY_SUBDIRECTORY;
+    }
+    return ENTRY_STAT;
+}
+
+/**
+ * Counts a stat'ed entry: a file is added up, a directory is queued.
+ */
+static void count_entry(Walk *walk, TaskQueue *queue, DirNode *node,
+                        const char *name, const struct stat *st) {
+    if (S_ISDIR(st->st_mode) && walk->options->recursive) {
+        if (!walk->options->one_filesystem || st->st_dev == walk->root_dev) {
+            add_subdirectory(walk, queue, node, name);
+        }
+    } else if (S_ISREG(st->st_mode) && !node->cached) {
+        if (st->st_nlink > 1) {
+            if (node->recordable) {
+                if (node->link_count == node->link_capacity) {
+                    node->link_capacity = node->link_capacity ? node->link_capacity * 2 : 16;
+                    node->links = realloc(node->links,
+                                          node->link_capacity * sizeof(DirSizeCacheLink));
+                }
+                node->links[node->link_count++] = (DirSizeCacheLink){st->st_ino, st->st_size};
+            }
+            add_link(walk, node, st->st_dev, st->st_ino, st->st_size, name);
+        } else {
+            node->own_bytes += st->st_size;
+            node->own_files++;
+            node->listed_bytes += st->st_size;
+            node->listed_files++;
+            offer_top(walk, &walk->top_files, st->st_size, node, name);
+        }
+    }
+}
+
+static void entry_failed(Walk *walk, DirNode *node) {
+    atomic_fetch_add(&walk->errors, 1);
+    node->recordable = false; // the files of this directory are not all known
+}
+
+/**
+ * Ends the listing of a directory once every entry is counted: records
+ * it for the cache and adds its files to the subtree.
+ */
+static void close_listing(Walk *walk, DirSizeCacheRecords *records, DirNode *node) {
+    if (node->recordable) {
+        DirSizeCacheEntry *entry = dirsize_cache_record(records, &node->self,
+                                                         node->parent ? &node->parent->self : NULL);
+        entry->bytes = node->own_bytes;
+        entry->files = node->own_files;
+        for (size_t i = 0; i < node->link_count; ++i) {
+            dirsize_cache_add_link(records, entry, node->links[i].inode, node->links[i].size);
+        }
+    }
+    free(node->links);
+    node->links = NULL;
+
+    atomic_fetch_add(&node->bytes, node->listed_bytes);
+    atomic_fetch_add(&node->files, node->listed_files);
+    release_fd(node);
+    finish_node(walk, node);
+}
 
-    if (!dir) {
-        fprintf(stderr, "Error: Unable to open directory %s\n", base_path);
-        return -1; // Return an error code
+/**
+ * Lists a directory and stats its entries one by one. Subdirectories are
+ * queued on the walking thread's queue.
+ */
+static void walk_directory(Walk *walk, Worker *worker, DirNode *node) {
+    int fd = open_listing(walk, node);
+    if (fd == -1) {
+        return;
     }
 
+    TaskQueue *queue = &walk->queues[worker->index];
     struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+    while ((entry = readdir(node->dir)) != NULL) {
+        switch (classify_entry(walk, node, entry)) {
+            case ENTRY_SUBDIRECTORY:
+                add_subdirectory(walk, queue, node, entry->d_name);
+                break;
+            case ENTRY_STAT: {
+                struct stat statbuf;
+                if (fstatat(fd, entry->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) != 0) {
+                    entry_failed(walk, node);
+                } else {
+                    count_entry(walk, queue, node, entry->d_name, &statbuf);
+                }
+                break;
+            }
+        }
+    }
+
+    close_listing(walk, walk->records ? &walk->records[worker->index] : NULL, node);
+}
+
+/**
+ * Parks a worker that found every queue empty until a directory is
+ * queued or the walk ends. The queues are looked at again after the
+ * worker counts itself idle, so a push in between is not missed.
+ */
+static void wait_for_work(Walk *walk) {
+    pthread_mutex_lock(&walk->idle_lock);
+    atomic_fetch_add(&walk->idle, 1);
+    bool queued = false;
+    for (int i = 0; !queued && i < walk->worker_count; ++i) {
+        pthread_mutex_lock(&walk->queues[i].lock);
+        queued = walk->queues[i].count > 0;
+        pthread_mutex_unlock(&walk->queues[i].lock);
+    }
+    if (!queued && atomic_load(&walk->outstanding) > 0) {
+        pthread_cond_wait(&walk->idle_cond, &walk->idle_lock);
+    }
+    atomic_fetch_sub(&walk->idle, 1);
+    pthread_mutex_unlock(&walk->idle_lock);
+}
+
+static void *walk_worker(void *data) {
+    Worker *worker = data;
+    Walk *walk = worker->walk;
+    TaskQueue *own = &walk->queues[worker->index];
+
+    while (atomic_load(&walk->outstanding) > 0) {
+        DirNode *node = pop_task(own, false);
+        // look for work on the other queues, starting at the next one
+        for (int i = 1; !node && i < walk->worker_count; ++i) {
+            node = pop_task(&walk->queues[(worker->index + i) % walk->worker_count], true);
+        }
+        if (!node) {
+            wait_for_work(walk);
             continue;
         }
+        walk_directory(walk, worker, node);
+        if (atomic_fetch_sub(&walk->outstanding, 1) == 1) {
+            wake_idle(walk, true);
+        }
+    }
+    return NULL;
+}
+
+#ifdef DIRSIZE_HAVE_IO_URING
+// statx calls submitted at once
+#define URING_DEPTH 512
+
+// Directories listed and waiting for their statx calls. Each holds an fd.
+#define URING_LISTINGS 64
+
+// Submission and completion rings shared with the kernel
+typedef struct {
+    int fd;
+    void *rings;
+    size_t rings_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, sq_entries;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+} Ring;
+
+// A statx call, its result and the name it is for
+typedef struct {
+    DirNode *node;
+    struct statx stx;
+    char name[];
+} StatRequest;
+
+/**
+ * Sets up a ring and checks that the kernel can run statx on it.
+ * @return 0 on success, -1 if io_uring or its statx are unavailable.
+ */
+static int ring_open(Ring *ring) {
+    struct io_uring_params params = {0};
+    ring->fd = syscall(__NR_io_uring_setup, URING_DEPTH, &params);
+    if (ring->fd == -1) {
+        return -1;
+    }
+
+    struct io_uring_probe *probe = calloc(1, sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op));
+    bool statx = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+                 probe->last_op >= IORING_OP_STATX &&
+                 (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    if (!statx || !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(ring->fd);
+        return -1;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->rings_size = sq_size > cq_size ? sq_size : cq_size;
+    ring->rings = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->rings == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->rings != MAP_FAILED) {
+            munmap(ring->rings, ring->rings_size);
+        }
+        close(ring->fd);
+        return -1;
+    }
+
+    char *rings = ring->rings;
+    ring->sq_head = (unsigned *)(rings + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(rings + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(rings + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(rings + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->cq_head = (unsigned *)(rings + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(rings + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(rings + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(rings + params.cq_off.cqes);
+    return 0;
+}
+
+static void ring_close(Ring *ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->rings, ring->rings_size);
+    close(ring->fd);
+}
+
+static void ring_push_statx(Ring *ring, StatRequest *request) {
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = dirfd(request->node->dir);
+    sqe->addr = (uintptr_t)request->name;
+    sqe->len = STATX_TYPE | STATX_INO | STATX_NLINK | STATX_SIZE;
+    sqe->off = (uintptr_t)&request->stx;
+    sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+    sqe->user_data = (uintptr_t)request;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Lists a directory and turns the entries that need a stat into
+ * requests. The listing is closed once the last of them completes.
+ */
+static void list_directory(Walk *walk, DirNode *node, StatRequest ***waiting,
+                           size_t *waiting_count, size_t *waiting_capacity,
+                           size_t *listings) {
+    if (open_listing(walk, node) == -1) {
+        return;
+    }
+
+    node->stats_pending = 1;
+    struct dirent *entry;
+    while ((entry = readdir(node->dir)) != NULL) {
+        switch (classify_entry(walk, node, entry)) {
+            case ENTRY_SUBDIRECTORY:
+                add_subdirectory(walk, &walk->queues[0], node, entry->d_name);
+                break;
+            case ENTRY_STAT: {
+                size_t len = strlen(entry->d_name) + 1;
+                StatRequest *request = malloc(sizeof(StatRequest) + len);
+                request->node = node;
+                memcpy(request->name, entry->d_name, len);
+                if (*waiting_count == *waiting_capacity) {
+                    *waiting_capacity = *waiting_capacity ? *waiting_capacity * 2 : 1024;
+                    *waiting = realloc(*waiting, *waiting_capacity * sizeof(StatRequest *));
+                }
+                (*waiting)[(*waiting_count)++] = request;
+                node->stats_pending++;
+                break;
+            }
+        }
+    }
+
+    if (--node->stats_pending == 0) {
+        close_listing(walk, walk->records, node);
+    } else {
+        (*listings)++;
+    }
+}
+
+/**
+ * Counts the result of a statx request and closes its directory's listing
+ * once that was the last request of it.
+ * @param st The entry's stat, NULL if the call failed.
+ */
+static void finish_request(Walk *walk, StatRequest *request, const struct stat *st,
+                           size_t *listings) {
+    DirNode *node = request->node;
+    if (st) {
+        count_entry(walk, &walk->queues[0], node, request->name, st);
+    } else {
+        entry_failed(walk, node);
+    }
+    free(request);
+    if (--node->stats_pending == 0) {
+        (*listings)--;
+        close_listing(walk, walk->records, node);
+    }
+}
+
+/**
+ * Stats a request's entry on the calling thread instead of the ring.
+ */
+static void stat_request(Walk *walk, StatRequest *request, size_t *listings) {
+    struct stat st;
+    bool found = fstatat(dirfd(request->node->dir), request->name, &st,
+                         AT_SYMLINK_NOFOLLOW) == 0;
+    finish_request(walk, request, found ? &st : NULL, listings);
+}
+
+static void reap_completions(Walk *walk, Ring *ring, size_t *in_flight, size_t *listings) {
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        StatRequest *request = (StatRequest *)(uintptr_t)cqe->user_data;
+        if (cqe->res < 0) {
+            finish_request(walk, request, NULL, listings);
+        } else {
+            struct stat st = {
+                .st_mode = request->stx.stx_mode,
+                .st_dev = makedev(request->stx.stx_dev_major, request->stx.stx_dev_minor),
+                .st_ino = request->stx.stx_ino,
+                .st_nlink = request->stx.stx_nlink,
+                .st_size = request->stx.stx_size,
+            };
+            finish_request(walk, request, &st, listings);
+        }
+        (*in_flight)--;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * Gives up on a ring that failed. The requests the kernel took are waited
+ * for, as it still writes their results, and the others are stat'ed on
+ * the calling thread, so every open listing gets finished. Directories
+ * still queued are left for the threads.
+ */
+static void abandon_ring(Walk *walk, Ring *ring, StatRequest **waiting, size_t waiting_count,
+                         size_t *in_flight, size_t *listings) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    for (; head != *ring->sq_tail; ++head) {
+        struct io_uring_sqe *sqe = &ring->sqes[ring->sq_array[head & *ring->sq_mask]];
+        stat_request(walk, (StatRequest *)(uintptr_t)sqe->user_data, listings);
+        (*in_flight)--;
+    }
+    while (*in_flight > 0) {
+        if (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+            errno != EINTR) {
+            nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+        }
+        reap_completions(walk, ring, in_flight, listings);
+    }
+    for (size_t i = 0; i < waiting_count; ++i) {
+        stat_request(walk, waiting[i], listings);
+    }
+}
 
-        char *path = malloc(strlen(base_path) + strlen(entry->d_name) + 2);
-        sprintf(path, "%s/%s", base_path, entry->d_name);
+/**
+ * Walks the tree on the calling thread. Directories are listed ahead
+ * while their entries are stat'ed by batches of statx calls through
+ * io_uring, so one thread keeps many requests queued on the device.
+ * @return 0 once the walk is done, -1 if io_uring is unavailable or
+ * failed, with the directories still queued left to walk.
+ */
+static int walk_with_io_uring(Walk *walk) {
+    Ring ring;
+    if (ring_open(&ring) == -1) {
+        return -1;
+    }
 
-        struct stat statbuf;
-        if (stat(path, &statbuf) != 0) {
-            fprintf(stderr, "Error: Unable to access file information %s\n", path);
-            free(path);
-            closedir(dir);
-            return -1; // Return an error code
+    StatRequest **waiting = NULL;
+    size_t waiting_count = 0, waiting_capacity = 0;
+    size_t listings = 0, in_flight = 0;
+    unsigned to_submit = 0;
+    for (;;) {
+        // list directories until there are enough entries to keep the ring full
+        DirNode *node;
+        while (listings < URING_LISTINGS && waiting_count < 2 * URING_DEPTH &&
+               (node = pop_task(&walk->queues[0], false)) != NULL) {
+            list_directory(walk, node, &waiting, &waiting_count, &waiting_capacity, &listings);
+            atomic_fetch_sub(&walk->outstanding, 1);
+        }
+        while (in_flight < ring.sq_entries && waiting_count > 0) {
+            ring_push_statx(&ring, waiting[--waiting_count]);
+            in_flight++;
+            to_submit++;
+        }
+        if (in_flight == 0) {
+            break; // nothing listed, nothing queued
         }
 
-        if (S_ISDIR(statbuf.st_mode) && recursive) {
-            long dir_size = calculate_directory_size(path, recursive);
-            if (dir_size == -1) {
-                // Pass the error up the call stack
-                free(path);
-                closedir(dir);
-                return -1; // Return an error code
+        int submitted = syscall(__NR_io_uring_enter, ring.fd, to_submit, 1,
+                                IORING_ENTER_GETEVENTS, NULL, 0);
+        if (submitted < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                continue;
             }
-            total_size += dir_size;
-        } else if (S_ISREG(statbuf.st_mode)) {
-            total_size += statbuf.st_size;
+            perror("-dirsize: io_uring_enter");
+            abandon_ring(walk, &ring, waiting, waiting_count, &in_flight, &listings);
+            free(waiting);
+            ring_close(&ring);
+            return -1;
         }
+        to_submit -= submitted;
+        reap_completions(walk, &ring, &in_flight, &listings);
+    }
+
+    free(waiting);
+    ring_close(&ring);
+    return 0;
+}
+#endif // DIRSIZE_HAVE_IO_URING
+
+DirSizeResult calculate_directory_size(const DirSizeOptions *options) {
+    Walk walk = {.options = options};
+    struct stat root;
+    if (stat(options->path, &root) != 0) {
+        fprintf(stderr, "Error: Unable to open directory %s\n", options->path);
+        walk.result.errors = 1;
+        return walk.result;
+    }
+    walk.root_dev = root.st_dev;
+
+    long threads = options->threads;
+    if (threads <= 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (!options->recursive || threads < 1) {
+        threads = 1;
+    }
+    walk.worker_count = threads;
+    walk.queues = calloc(threads, sizeof(TaskQueue));
+    for (long i = 0; i < threads; ++i) {
+        pthread_mutex_init(&walk.queues[i].lock, NULL);
+    }
+    for (int i = 0; i < LINK_SHARDS; ++i) {
+        pthread_mutex_init(&walk.links[i].lock, NULL);
+    }
+    TopHeap *heaps[] = {&walk.top_directories, &walk.top_files};
+    for (int i = 0; i < 2; ++i) {
+        pthread_mutex_init(&heaps[i]->lock, NULL);
+        heaps[i]->entries = malloc(((options->top > 0 ? options->top : 0) + 1) * sizeof(DirSizeEntry));
+        atomic_init(&heaps[i]->floor, 0);
+    }
 
-        free(path);
+    DirSizeCache *cache = NULL;
+    if (options->cache_path) {
+        cache = dirsize_cache_open(options->cache_path);
+        walk.cache = cache;
+        walk.records = calloc(threads, sizeof(DirSizeCacheRecords));
+        walk.started = time(NULL);
     }
 
-    closedir(dir);
-    return total_size;
+    atomic_init(&walk.outstanding, 1);
+    atomic_init(&walk.idle, 0);
+    pthread_mutex_init(&walk.idle_lock, NULL);
+    pthread_cond_init(&walk.idle_cond, NULL);
+    push_task(&walk.queues[0], new_node(NULL, options->path));
+
+#ifdef DIRSIZE_HAVE_IO_URING
+    bool walked = options->io_uring && walk_with_io_uring(&walk) == 0;
+#else
+    bool walked = false;
+#endif
+    if (options->io_uring && !walked) {
+        fprintf(stderr, "dirsize: io_uring is not available, walking with threads\n");
+    }
+
+    // the calling thread is the first worker
+    Worker *workers = malloc(threads * sizeof(Worker));
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    for (long i = 0; i < threads && !walked; ++i) {
+        workers[i] = (Worker){&walk, i};
+        if (i > 0) {
+            pthread_create(&ids[i], NULL, walk_worker, &workers[i]);
+        }
+    }
+    if (!walked) {
+        walk_worker(&workers[0]);
+    }
+    for (long i = 1; i < threads && !walked; ++i) {
+        pthread_join(ids[i], NULL);
+    }
+    free(ids);
+    free(workers);
+
+    for (long i = 0; i < threads; ++i) {
+        pthread_mutex_destroy(&walk.queues[i].lock);
+        free(walk.queues[i].nodes);
+    }
+    free(walk.queues);
+    pthread_mutex_destroy(&walk.idle_lock);
+    pthread_cond_destroy(&walk.idle_cond);
+    for (int i = 0; i < LINK_SHARDS; ++i) {
+        pthread_mutex_destroy(&walk.links[i].lock);
+        free(walk.links[i].keys);
+    }
+
+    if (cache) {
+        if (atomic_load(&walk.directories)) {
+            dirsize_cache_save(cache, options->cache_path, walk.records, threads,
+                               options->recursive ? &root : NULL);
+        }
+        for (long i = 0; i < threads; ++i) {
+            dirsize_cache_records_free(&walk.records[i]);
+        }
+        free(walk.records);
+        dirsize_cache_close(cache);
+    }
+
+    walk.result.io_uring = walked;
+    walk.result.directories = atomic_load(&walk.directories);
+    walk.result.errors = atomic_load(&walk.errors);
+    walk.result.cached_directories = atomic_load(&walk.cached_directories);
+    walk.result.cached_bytes = atomic_load(&walk.cached_bytes);
+    walk.result.largest_directories =
+        take_top(&walk.top_directories, &walk.result.largest_directory_count);
+    walk.result.largest_files = take_top(&walk.top_files, &walk.result.largest_file_count);
+    return walk.result;
+}
+
+void dirsize_result_free(DirSizeResult *result) {
+    for (size_t i = 0; i < result->largest_directory_count; ++i) {
+        free(result->largest_directories[i].path);
+    }
+    for (size_t i = 0; i < result->largest_file_count; ++i) {
+        free(result->largest_files[i].path);
+    }
+    free(result->largest_directories);
+    free(result->largest_files);
+    result->largest_directories = result->largest_files = NULL;
+    result->largest_directory_count = result->largest_file_count = 0;
 }
 
-void calculate_dir_size(const DirSizeOptions *options) {
-    long total_size = calculate_directory_size(options->path, options->recursive);
-    if (total_size == -1) {
+int calculate_dir_size(const DirSizeOptions *options) {
+    DirSizeResult result = calculate_directory_size(options);
+    if (result.directories == 0) {
         fprintf(stderr, "Error: An error occurred while calculating the directory size.\n");
-        exit(EXIT_FAILURE); // Terminate the program
+        dirsize_result_free(&result);
+        return -1;
     }
 
-    printf("Total size of directory '%s': %ld bytes\n", options->path, total_size);
+    printf("Total size of directory '%s': %llu bytes\n", options->path, result.bytes);
+    printf("%llu files in %llu directories", result.files, result.directories);
+    if (result.errors) {
+        printf(", %llu entries could not be read", result.errors);
+    }
+    printf("\n");
+    if (options->cache_path) {
+        printf("%llu of %llu directories and %llu bytes served from cache\n",
+               result.cached_directories, result.directories, result.cached_bytes);
+    }
+
+    if (options->top > 0) {
+        const struct {
+            const char *title;
+            const DirSizeEntry *entries;
+            size_t count;
+        } lists[] = {
+            {"Largest directories", result.largest_directories, result.largest_directory_count},
+            {"Largest files", result.largest_files, result.largest_file_count},
+        };
+        for (int i = 0; i < 2; ++i) {
+            printf("%s:\n", lists[i].title);
+            for (size_t j = 0; j < lists[i].count; ++j) {
+                printf("%15llu  %s\n", lists[i].entries[j].bytes, lists[i].entries[j].path);
+            }
+        }
+    }
+    dirsize_result_free(&result);
+    return 0;
 }
 
+// The shell links this file in as a builtin and brings its own main
+#ifndef SHELLECT_BUILTIN
 int main(int argc, char *argv[]) {
     DirSizeOptions options = {.path = ".", .recursive = 0};
 
     // Parse command line arguments
     int opt;
-    while ((opt = getopt(argc, argv, "r")) != -1) {
+    char cache_path[4096];
+    while ((opt = getopt(argc, argv, "rxcuj:t:d:")) != -1) {
         switch (opt) {
             case 'r':
                 options.recursive = 1;
                 break;
+            case 'x':
+                options.one_filesystem = 1;
+                break;
+            case 'c':
+                snprintf(cache_path, sizeof(cache_path), "%s/" DIRSIZE_CACHE_FILE,
+                         getenv("HOME") ? getenv("HOME") : ".");
+                options.cache_path = cache_path;
+                break;
+            case 'u':
+                options.io_uring = 1;
+                break;
+            case 'j':
+                options.threads = atoi(optarg);
+                break;
+            case 't':
+                options.top = atoi(optarg);
+                break;
+            case 'd':
+                options.max_depth = atoi(optarg);
+                break;
             default:
-                fprintf(stderr, "Usage: %s [-r] [path]\n", argv[0]);
+                fprintf(stderr, "Usage: %s [-rxcu] [-j threads] [-t top] [-d depth] [path]\n", argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
@@ -82,7 +1072,10 @@ int main(int argc, char *argv[]) {
         options.path = argv[optind];
     }
 
-    calculate_dir_size(&options);
+    if (calculate_dir_size(&options) == -1) {
+        return EXIT_FAILURE; // Terminate the program
+    }
 
     return EXIT_SUCCESS;
 }
+#endif // SHELLECT_BUILTIN
@@ -1,16 +1,63 @@
 #ifndef DIRSIZE_H
 #define DIRSIZE_H
 
+#include <stddef.h>
 
 typedef struct {
     const char *path;   // Path to the directory
     int recursive;      // Flag to indicate if subdirectories should be included
+    int one_filesystem; // Flag to stay on the file system of path
+    int threads;        // Directories walked at once, 0 for one per online CPU
+    const char *cache_path; // Per-directory size cache to use and update, or NULL
+    int io_uring;       // Flag to stat entries in batches through io_uring on one thread
+    int top;            // Largest directories and files to report, 0 for none
+    int max_depth;      // Deepest directories reported, 0 for any depth
 } DirSizeOptions;
 
+typedef struct {
+    char *path;
+    unsigned long long bytes;   // For a directory, the total of its subtree
+} DirSizeEntry;
+
+typedef struct {
+    unsigned long long bytes;       // Size of the regular files, each inode once
+    unsigned long long files;       // Number of regular files counted
+    unsigned long long directories; // Number of directories read
+    unsigned long long errors;      // Entries that could not be opened or stat'ed
+    unsigned long long cached_directories; // Directories whose files came from the cache
+    unsigned long long cached_bytes;       // Bytes of those files
+    int io_uring;                   // Flag set when io_uring did the whole walk
+    DirSizeEntry *largest_directories;     // Largest first, below path
+    size_t largest_directory_count;
+    DirSizeEntry *largest_files;
+    size_t largest_file_count;
+} DirSizeResult;
+
+/**
+ * Walks a directory with a pool of threads. Every directory is opened
+ * relative to its parent's fd and every entry is fstatat'ed without
+ * following symlinks, so no paths are built. Subdirectories go to the
+ * walking thread's own queue, and idle threads steal from the others.
+ * Files with several hard links are counted once. With a cache, the
+ * files of a directory whose mtime and ctime are unchanged are taken
+ * from it without a stat, and the cache is updated at the end.
+ * With options->top, every directory's total is known when its subtree
+ * is done, and the largest directories and files are kept in heaps of
+ * that size, so memory does not grow with the tree. The cache is not
+ * read then, since the files must be seen.
+ * @param options DirSizeOptions containing path and walk flags.
+ * @return The totals. If path could not be opened, directories is 0.
+ * The lists are released with dirsize_result_free.
+ */
+DirSizeResult calculate_directory_size(const DirSizeOptions *options);
+
+void dirsize_result_free(DirSizeResult *result);
+
 /**
  * Calculates the total size of files in a directory based on the given options.
  * @param options DirSizeOptions containing path and recursive flag.
+ * @return 0 on success, -1 if the directory could not be walked.
  */
-void calculate_dir_size(const DirSizeOptions *options);
+int calculate_dir_size(const DirSizeOptions *options);
 
 #endif // DIRSIZE_H
@@ -0,0 +1,319 @@
+#define _GNU_SOURCE
+#include "dirsizecache.h"
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define DIRSIZE_CACHE_MAGIC "SHDSZC02"
+
+/*
+ * On disk, mapped in place: DirSizeCacheHeader, DirSizeCacheEntry
+ * [entry_count] sorted by device and inode, and DirSizeCacheLink
+ * [link_count].
+ */
+typedef struct {
+	char magic[8];
+	uint64_t entry_count;
+	uint64_t link_count;
+} DirSizeCacheHeader;
+
+struct DirSizeCache {
+	void *map;
+	size_t map_size;
+	const DirSizeCacheEntry *entries;
+	size_t entry_count;
+	const DirSizeCacheLink *links;
+	size_t link_count;
+	atomic_bool *seen; // per entry, found unchanged during this walk
+};
+
+// a directory just read, with the links of the record it belongs to
+typedef struct {
+	const DirSizeCacheEntry *entry;
+	const DirSizeCacheLink *links;
+} NewEntry;
+
+DirSizeCache *dirsize_cache_open(const char *path) {
+	DirSizeCache *cache = calloc(1, sizeof(DirSizeCache));
+	int fd = path ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+	if (fd == -1)
+		return cache;
+	struct stat st;
+	if (fstat(fd, &st) == -1 ||
+		(size_t)st.st_size < sizeof(DirSizeCacheHeader)) {
+		close(fd);
+		return cache;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return cache;
+
+	const DirSizeCacheHeader *header = map;
+	if (memcmp(header->magic, DIRSIZE_CACHE_MAGIC, sizeof(header->magic)) !=
+			0 ||
+		header->entry_count > (uint64_t)st.st_size / sizeof(DirSizeCacheEntry) ||
+		header->link_count > (uint64_t)st.st_size / sizeof(DirSizeCacheLink) ||
+		sizeof(DirSizeCacheHeader) +
+				header->entry_count * sizeof(DirSizeCacheEntry) +
+				header->link_count * sizeof(DirSizeCacheLink) !=
+			(uint64_t)st.st_size) {
+		munmap(map, st.st_size);
+		return cache;
+	}
+
+	cache->map = map;
+	cache->map_size = st.st_size;
+	cache->entries = (const DirSizeCacheEntry *)(header + 1);
+	cache->entry_count = header->entry_count;
+	cache->links = (const DirSizeCacheLink *)(cache->entries +
+											 cache->entry_count);
+	cache->link_count = header->link_count;
+	cache->seen = calloc(cache->entry_count, sizeof(atomic_bool));
+	return cache;
+}
+
+static int compare_entry(const DirSizeCacheEntry *x,
+						 const DirSizeCacheEntry *y) {
+	if (x->dev != y->dev)
+		return x->dev > y->dev ? 1 : -1;
+	return (x->inode > y->inode) - (x->inode < y->inode);
+}
+
+static int compare_new(const void *a, const void *b) {
+	return compare_entry(((const NewEntry *)a)->entry,
+						 ((const NewEntry *)b)->entry);
+}
+
+/**
+ * Finds the entry of a directory by device and inode.
+ * @return Its index, or cache->entry_count if there is none.
+ */
+static size_t find_index(const DirSizeCache *cache, uint64_t dev,
+						 uint64_t inode) {
+	DirSizeCacheEntry key = { .dev = dev, .inode = inode };
+	size_t low = 0, high = cache->entry_count;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		int order = compare_entry(&cache->entries[middle], &key);
+		if (order == 0)
+			return middle;
+		if (order < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return cache->entry_count;
+}
+
+const DirSizeCacheEntry *dirsize_cache_find(const DirSizeCache *cache,
+											const struct stat *dir) {
+	size_t index = find_index(cache, dir->st_dev, dir->st_ino);
+	if (index == cache->entry_count)
+		return NULL;
+	const DirSizeCacheEntry *entry = &cache->entries[index];
+	if (entry->mtime_sec != dir->st_mtim.tv_sec ||
+		entry->mtime_nsec != dir->st_mtim.tv_nsec ||
+		entry->ctime_sec != dir->st_ctim.tv_sec ||
+		entry->ctime_nsec != dir->st_ctim.tv_nsec ||
+		entry->link_first + entry->link_count > cache->link_count)
+		return NULL;
+	atomic_store_explicit(&cache->seen[index], true, memory_order_relaxed);
+	return entry;
+}
+
+const DirSizeCacheLink *dirsize_cache_links(const DirSizeCache *cache,
+											const DirSizeCacheEntry *entry) {
+	return cache->links + entry->link_first;
+}
+
+DirSizeCacheEntry *dirsize_cache_record(DirSizeCacheRecords *records,
+										const struct stat *dir,
+										const struct stat *parent) {
+	if (records->entry_count == records->entry_capacity) {
+		records->entry_capacity =
+			records->entry_capacity ? records->entry_capacity * 2 : 64;
+		records->entries =
+			realloc(records->entries,
+					records->entry_capacity * sizeof(DirSizeCacheEntry));
+	}
+	DirSizeCacheEntry *entry = &records->entries[records->entry_count++];
+	*entry = (DirSizeCacheEntry){
+		.dev = dir->st_dev,
+		.inode = dir->st_ino,
+		.parent = parent && parent->st_dev == dir->st_dev ? parent->st_ino : 0,
+		.mtime_sec = dir->st_mtim.tv_sec,
+		.mtime_nsec = dir->st_mtim.tv_nsec,
+		.ctime_sec = dir->st_ctim.tv_sec,
+		.ctime_nsec = dir->st_ctim.tv_nsec,
+		.link_first = records->link_count,
+	};
+	return entry;
+}
+
+void dirsize_cache_add_link(DirSizeCacheRecords *records,
+							DirSizeCacheEntry *entry, uint64_t inode,
+							uint64_t size) {
+	if (records->link_count == records->link_capacity) {
+		records->link_capacity =
+			records->link_capacity ? records->link_capacity * 2 : 64;
+		records->links = realloc(
+			records->links, records->link_capacity * sizeof(DirSizeCacheLink));
+	}
+	records->links[records->link_count++] = (DirSizeCacheLink){ inode, size };
+	entry->link_count++;
+}
+
+static void write_entry(FILE *out, const DirSizeCacheEntry *entry,
+						uint64_t *link_first) {
+	DirSizeCacheEntry copy = *entry;
+	copy.link_first = *link_first;
+	*link_first += copy.link_count;
+	fwrite(&copy, sizeof(copy), 1, out);
+}
+
+enum { TREE_UNKNOWN, TREE_BELOW, TREE_OUTSIDE, TREE_VISITING };
+
+/**
+ * Tells whether an old entry lies below the root of a walk by following
+ * the parents through the old entries. The answer is kept in trees for
+ * every entry on the way, so each entry is followed once.
+ * @param chain Room for cache->entry_count indexes.
+ */
+static bool below_root(const DirSizeCache *cache, unsigned char *trees,
+					   size_t *chain, size_t index, const struct stat *root) {
+	size_t length = 0;
+	unsigned char tree;
+	for (;;) {
+		if (index == cache->entry_count || trees[index] == TREE_VISITING) {
+			// the parent is not cached, or a reused inode made a loop
+			tree = TREE_OUTSIDE;
+			break;
+		}
+		if (trees[index] != TREE_UNKNOWN) {
+			tree = trees[index];
+			break;
+		}
+		const DirSizeCacheEntry *entry = &cache->entries[index];
+		if (entry->inode == (uint64_t)root->st_ino) {
+			tree = TREE_BELOW;
+			break;
+		}
+		trees[index] = TREE_VISITING;
+		chain[length++] = index;
+		index = entry->parent ? find_index(cache, entry->dev, entry->parent)
+							  : cache->entry_count;
+	}
+	while (length > 0)
+		trees[chain[--length]] = tree;
+	return tree == TREE_BELOW;
+}
+
+int dirsize_cache_save(const DirSizeCache *cache, const char *path,
+					   DirSizeCacheRecords *records, size_t record_count,
+					   const struct stat *root) {
+	size_t new_count = 0;
+	for (size_t i = 0; i < record_count; ++i)
+		new_count += records[i].entry_count;
+	NewEntry *fresh = malloc((new_count + 1) * sizeof(NewEntry));
+	new_count = 0;
+	for (size_t i = 0; i < record_count; ++i)
+		for (size_t j = 0; j < records[i].entry_count; ++j)
+			fresh[new_count++] = (NewEntry){ &records[i].entries[j],
+											 records[i].links };
+	qsort(fresh, new_count, sizeof(NewEntry), compare_new);
+
+	// merge both sorted lists, a directory just read replaces its old entry
+	// and one the walk should have met but did not is dropped
+	unsigned char *trees = calloc(cache->entry_count + 1, 1);
+	size_t *chain = malloc((cache->entry_count + 1) * sizeof(size_t));
+	const DirSizeCacheEntry **merged =
+		malloc((new_count + cache->entry_count + 1) *
+			   sizeof(DirSizeCacheEntry *));
+	const DirSizeCacheLink **merged_links =
+		malloc((new_count + cache->entry_count + 1) *
+			   sizeof(DirSizeCacheLink *));
+	size_t count = 0, old = 0, link_count = 0;
+	for (size_t i = 0; i <= new_count; ++i) {
+		while (old < cache->entry_count &&
+			   (i == new_count ||
+				compare_entry(&cache->entries[old], fresh[i].entry) <= 0)) {
+			bool missed =
+				root && cache->entries[old].dev == (uint64_t)root->st_dev &&
+				!atomic_load_explicit(&cache->seen[old],
+									  memory_order_relaxed) &&
+				below_root(cache, trees, chain, old, root);
+			if (!missed &&
+				(i == new_count ||
+				 compare_entry(&cache->entries[old], fresh[i].entry) < 0)) {
+				merged[count] = &cache->entries[old];
+				merged_links[count++] = cache->links;
+				link_count += cache->entries[old].link_count;
+			}
+			old++;
+		}
+		if (i == new_count)
+			break;
+		merged[count] = fresh[i].entry;
+		merged_links[count++] = fresh[i].links;
+		link_count += fresh[i].entry->link_count;
+	}
+	free(fresh);
+	free(trees);
+	free(chain);
+
+	size_t tmp_size = strlen(path) + 32;
+	char *tmp = malloc(tmp_size);
+	snprintf(tmp, tmp_size, "%s.%d.tmp", path, (int)getpid());
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	FILE *out = fd == -1 ? NULL : fdopen(fd, "w");
+	if (!out) {
+		perror("-dirsize: " DIRSIZE_CACHE_FILE);
+		if (fd != -1)
+			close(fd);
+		free(tmp);
+		free(merged);
+		free(merged_links);
+		return -1;
+	}
+
+	DirSizeCacheHeader header = { .entry_count = count,
+								  .link_count = link_count };
+	memcpy(header.magic, DIRSIZE_CACHE_MAGIC, sizeof(header.magic));
+	fwrite(&header, sizeof(header), 1, out);
+	uint64_t link_first = 0;
+	for (size_t i = 0; i < count; ++i)
+		write_entry(out, merged[i], &link_first);
+	for (size_t i = 0; i < count; ++i)
+		if (merged[i]->link_count)
+			fwrite(merged_links[i] + merged[i]->link_first,
+				   sizeof(DirSizeCacheLink), merged[i]->link_count, out);
+	free(merged);
+	free(merged_links);
+
+	int result = 0;
+	if (ferror(out) | (fclose(out) == EOF) || rename(tmp, path) == -1) {
+		perror("-dirsize: " DIRSIZE_CACHE_FILE);
+		unlink(tmp);
+		result = -1;
+	}
+	free(tmp);
+	return result;
+}
+
+void dirsize_cache_records_free(DirSizeCacheRecords *records) {
+	free(records->entries);
+	free(records->links);
+}
+
+void dirsize_cache_close(DirSizeCache *cache) {
+	if (cache->map)
+		munmap(cache->map, cache->map_size);
+	free(cache->seen);
+	free(cache);
+}
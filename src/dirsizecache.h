@@ -0,0 +1,94 @@
+#ifndef DIRSIZECACHE_H
+#define DIRSIZECACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// cache file, relative to $HOME
+#define DIRSIZE_CACHE_FILE ".shellect_dirsize_cache"
+
+/*
+ * What a directory held the last time it was read: the regular files
+ * with a single link, added up, and those with several links one by one,
+ * so they are still counted once per walk when the directory is reused.
+ * Subdirectories are not included, they are looked up on their own.
+ */
+typedef struct {
+	uint64_t dev;
+	uint64_t inode;
+	uint64_t parent; // inode of the parent on the same device, 0 if none
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	int64_t ctime_sec;
+	int64_t ctime_nsec;
+	uint64_t bytes;
+	uint64_t files;
+	uint64_t link_first; // index of the first DirSizeCacheLink
+	uint64_t link_count;
+} DirSizeCacheEntry;
+
+typedef struct {
+	uint64_t inode; // on the device of the directory
+	uint64_t size;
+} DirSizeCacheLink;
+
+// directories read during a walk, appended in any order
+typedef struct {
+	DirSizeCacheEntry *entries;
+	size_t entry_count, entry_capacity;
+	DirSizeCacheLink *links;
+	size_t link_count, link_capacity;
+} DirSizeCacheRecords;
+
+typedef struct DirSizeCache DirSizeCache;
+
+/**
+ * Maps a cache file. A missing or unreadable file gives an empty cache.
+ */
+DirSizeCache *dirsize_cache_open(const char *path);
+
+/**
+ * Finds a directory whose inode, mtime and ctime still match the cache.
+ * Adding, removing or renaming an entry changes the mtime of a directory,
+ * but writing to a file inside it does not.
+ * @return The entry, or NULL if the directory must be read.
+ */
+const DirSizeCacheEntry *dirsize_cache_find(const DirSizeCache *cache,
+											const struct stat *dir);
+
+const DirSizeCacheLink *dirsize_cache_links(const DirSizeCache *cache,
+											const DirSizeCacheEntry *entry);
+
+/**
+ * Starts the record of a directory. Its files are then added with
+ * dirsize_cache_add_link and by adding to bytes and files.
+ * @param parent The directory the walk found it in, NULL for the root.
+ */
+DirSizeCacheEntry *dirsize_cache_record(DirSizeCacheRecords *records,
+										const struct stat *dir,
+										const struct stat *parent);
+
+void dirsize_cache_add_link(DirSizeCacheRecords *records,
+							DirSizeCacheEntry *entry, uint64_t inode,
+							uint64_t size);
+
+/**
+ * Writes the cache again with the directories just read, replacing their
+ * old entries, and the other old entries as they were. The file is
+ * written to a temporary file and renamed over the old one.
+ * @param root Root of a recursive walk, NULL for other walks. Such a walk
+ * meets every directory below its root, so the old entries below it that
+ * it neither read nor found with dirsize_cache_find were deleted or moved
+ * away, and are dropped. They are tied to the root by their parents.
+ * @return 0 on success, -1 on error.
+ */
+int dirsize_cache_save(const DirSizeCache *cache, const char *path,
+					   DirSizeCacheRecords *records, size_t record_count,
+					   const struct stat *root);
+
+void dirsize_cache_records_free(DirSizeCacheRecords *records);
+
+void dirsize_cache_close(DirSizeCache *cache);
+
+#endif // DIRSIZECACHE_H
@@ -0,0 +1,535 @@
+#define _GNU_SOURCE
+#include "findindex.h"
+#include "findstring.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define FINDINDEX_MAGIC "SHFIDX01"
+
+// trigrams are the three bytes themselves, so there are 1 << 24 of them
+#define TRIGRAM_COUNT (1U << 24)
+#define TRIGRAM(text) \
+	((uint32_t)(unsigned char)(text)[0] << 16 | \
+	 (uint32_t)(unsigned char)(text)[1] << 8 | (unsigned char)(text)[2])
+
+#define NO_FILE UINT32_MAX
+
+/*
+ * On disk, every part is aligned to 8 bytes and mapped in place:
+ * IndexHeader, IndexFile[file_count] sorted by name, IndexTrigram
+ * [trigram_count] sorted by key, the posting lists as uint32_t file ids,
+ * and the NUL terminated file names.
+ */
+typedef struct {
+	char magic[8];
+	uint32_t file_count;
+	uint32_t trigram_count;
+	uint64_t postings_offset;
+	uint64_t names_offset;
+} IndexHeader;
+
+typedef struct {
+	uint64_t inode;
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint32_t name; // offset into the names
+	uint32_t padding;
+} IndexFile;
+
+typedef struct {
+	uint32_t key;
+	uint32_t count;
+	uint64_t first; // index of the first file id in the postings
+} IndexTrigram;
+
+struct FindIndex {
+	const char *map;
+	size_t map_size;
+	const IndexHeader *header;
+	const IndexFile *files;
+	const IndexTrigram *trigrams;
+	const uint32_t *postings;
+	const char *names;
+	bool *candidates; // result of the last query, per file
+};
+
+// posting list being built, ids are appended in any order
+typedef struct {
+	uint32_t key;
+	uint32_t count, capacity;
+	uint32_t *ids;
+} Posting;
+
+typedef struct {
+	Posting *slots; // open addressing on the trigram, count == 0 is free
+	size_t capacity, used;
+} PostingTable;
+
+typedef struct {
+	char *name;
+	struct stat st;
+	uint32_t old_id; // id in the old index, NO_FILE if it must be read
+} BuildFile;
+
+static bool stat_matches(const IndexFile *file, const struct stat *st) {
+	return file->inode == (uint64_t)st->st_ino &&
+		   file->size == (uint64_t)st->st_size &&
+		   file->mtime_sec == st->st_mtim.tv_sec &&
+		   file->mtime_nsec == st->st_mtim.tv_nsec;
+}
+
+/**
+ * Checks that every part of a mapped index lies inside the file, so a
+ * truncated or damaged index is never read out of bounds: the sections
+ * are in order, each posting list is inside the postings, every file id
+ * is one of the files and every name is inside the NUL terminated names.
+ */
+static bool index_valid(const char *map, size_t size) {
+	const IndexHeader *header = (const IndexHeader *)map;
+	if (memcmp(header->magic, FINDINDEX_MAGIC, sizeof(header->magic)) != 0)
+		return false;
+	size_t tables = sizeof(IndexHeader) +
+					header->file_count * sizeof(IndexFile) +
+					header->trigram_count * sizeof(IndexTrigram);
+	if (tables > header->postings_offset ||
+		header->postings_offset % sizeof(uint32_t) != 0 ||
+		header->postings_offset > header->names_offset ||
+		header->names_offset > size ||
+		(header->file_count > 0 && map[size - 1] != '\0'))
+		return false;
+
+	const IndexFile *files = (const IndexFile *)(header + 1);
+	uint64_t names_size = size - header->names_offset;
+	for (uint32_t i = 0; i < header->file_count; ++i)
+		if (files[i].name >= names_size)
+			return false;
+
+	const IndexTrigram *trigrams =
+		(const IndexTrigram *)(files + header->file_count);
+	const uint32_t *postings = (const uint32_t *)(map + header->postings_offset);
+	uint64_t id_count = (header->names_offset - header->postings_offset) /
+						sizeof(uint32_t);
+	for (uint32_t i = 0; i < header->trigram_count; ++i) {
+		if (trigrams[i].first > id_count ||
+			trigrams[i].count > id_count - trigrams[i].first)
+			return false;
+		const uint32_t *ids = postings + trigrams[i].first;
+		for (uint32_t j = 0; j < trigrams[i].count; ++j)
+			if (ids[j] >= header->file_count)
+				return false;
+	}
+	return true;
+}
+
+FindIndex *findindex_open(int dir_fd) {
+	int fd = openat(dir_fd, FINDINDEX_FILE, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+	struct stat st;
+	if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(IndexHeader)) {
+		close(fd);
+		return NULL;
+	}
+	const char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	if (!index_valid(map, st.st_size)) {
+		munmap((void *)map, st.st_size);
+		return NULL;
+	}
+
+	const IndexHeader *header = (const IndexHeader *)map;
+	FindIndex *index = malloc(sizeof(FindIndex));
+	index->map = map;
+	index->map_size = st.st_size;
+	index->header = header;
+	index->files = (const IndexFile *)(header + 1);
+	index->trigrams =
+		(const IndexTrigram *)(index->files + header->file_count);
+	index->postings = (const uint32_t *)(map + header->postings_offset);
+	index->names = map + header->names_offset;
+	index->candidates = calloc(header->file_count + 1, sizeof(bool));
+	return index;
+}
+
+void findindex_close(FindIndex *index) {
+	if (!index)
+		return;
+	munmap((void *)index->map, index->map_size);
+	free(index->candidates);
+	free(index);
+}
+
+static const IndexTrigram *find_trigram(const FindIndex *index,
+										uint32_t key) {
+	size_t low = 0, high = index->header->trigram_count;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (index->trigrams[middle].key < key)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	if (low < index->header->trigram_count && index->trigrams[low].key == key)
+		return &index->trigrams[low];
+	return NULL;
+}
+
+static int compare_count(const void *a, const void *b) {
+	const IndexTrigram *x = *(const IndexTrigram *const *)a;
+	const IndexTrigram *y = *(const IndexTrigram *const *)b;
+	return (x->count > y->count) - (x->count < y->count);
+}
+
+bool findindex_query(FindIndex *index, const char *pattern,
+					 size_t pattern_len) {
+	uint32_t file_count = index->header->file_count;
+	if (pattern_len < 3) {
+		memset(index->candidates, true, file_count);
+		return true;
+	}
+	memset(index->candidates, false, file_count);
+
+	size_t count = pattern_len - 2;
+	const IndexTrigram **lists = malloc(count * sizeof(IndexTrigram *));
+	for (size_t i = 0; i < count; ++i) {
+		lists[i] = find_trigram(index, TRIGRAM(pattern + i));
+		if (!lists[i]) {
+			free(lists);
+			return false;
+		}
+	}
+	// intersect starting from the shortest list, so the candidate set
+	// is small from the start
+	qsort(lists, count, sizeof(IndexTrigram *), compare_count);
+
+	const uint32_t *first = index->postings + lists[0]->first;
+	uint32_t *matches = malloc(lists[0]->count * sizeof(uint32_t));
+	memcpy(matches, first, lists[0]->count * sizeof(uint32_t));
+	size_t match_count = lists[0]->count;
+	for (size_t i = 1; i < count && match_count > 0; ++i) {
+		if (lists[i] == lists[i - 1])
+			continue; // repeated trigram
+		const uint32_t *ids = index->postings + lists[i]->first;
+		size_t kept = 0, j = 0;
+		for (size_t k = 0; k < match_count; ++k) {
+			while (j < lists[i]->count && ids[j] < matches[k])
+				j++;
+			if (j == lists[i]->count)
+				break;
+			if (ids[j] == matches[k])
+				matches[kept++] = matches[k];
+		}
+		match_count = kept;
+	}
+
+	for (size_t k = 0; k < match_count; ++k)
+		index->candidates[matches[k]] = true;
+	free(matches);
+	free(lists);
+	return match_count > 0;
+}
+
+/**
+ * Finds a file of the index by name.
+ * @return Its id, or NO_FILE.
+ */
+static uint32_t find_file(const FindIndex *index, const char *name) {
+	uint32_t low = 0, high = index->header->file_count;
+	while (low < high) {
+		uint32_t middle = low + (high - low) / 2;
+		int order = strcmp(index->names + index->files[middle].name, name);
+		if (order == 0)
+			return middle;
+		if (order < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return NO_FILE;
+}
+
+bool findindex_excludes(const FindIndex *index, const char *name,
+						const struct stat *st) {
+	uint32_t id = find_file(index, name);
+	return id != NO_FILE && !index->candidates[id] &&
+		   stat_matches(&index->files[id], st);
+}
+
+static size_t hash_trigram(uint32_t key) {
+	return (key * 0x9E3779B97F4A7C15ULL) >> 32; // Fibonacci hashing
+}
+
+static void posting_grow(PostingTable *table) {
+	PostingTable grown = { calloc(table->capacity * 2, sizeof(Posting)),
+						   table->capacity * 2, 0 };
+	for (size_t i = 0; i < table->capacity; ++i) {
+		Posting *posting = &table->slots[i];
+		if (!posting->count)
+			continue;
+		size_t slot = hash_trigram(posting->key) & (grown.capacity - 1);
+		while (grown.slots[slot].count)
+			slot = (slot + 1) & (grown.capacity - 1);
+		grown.slots[slot] = *posting;
+		grown.used++;
+	}
+	free(table->slots);
+	*table = grown;
+}
+
+static void posting_add(PostingTable *table, uint32_t key, uint32_t id) {
+	if ((table->used + 1) * 2 > table->capacity)
+		posting_grow(table);
+	size_t slot = hash_trigram(key) & (table->capacity - 1);
+	while (table->slots[slot].count && table->slots[slot].key != key)
+		slot = (slot + 1) & (table->capacity - 1);
+
+	Posting *posting = &table->slots[slot];
+	if (!posting->count) {
+		posting->key = key;
+		table->used++;
+	}
+	if (posting->count == posting->capacity) {
+		posting->capacity = posting->capacity ? posting->capacity * 2 : 4;
+		posting->ids =
+			realloc(posting->ids, posting->capacity * sizeof(uint32_t));
+	}
+	posting->ids[posting->count++] = id;
+}
+
+/**
+ * Adds every distinct trigram of a file to the postings.
+ * @param seen Zeroed bitmap of TRIGRAM_COUNT bits, zeroed again on return.
+ * @param keys Receives the trigrams of the file, to clear them from seen.
+ * @return 0 on success, -1 if the file could not be read.
+ */
+static int index_file(PostingTable *table, int dir_fd, const BuildFile *file,
+					  uint32_t id, uint64_t *seen, Posting *keys) {
+	if (file->st.st_size < 3)
+		return 0;
+	int fd = openat(dir_fd, file->name, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	const char *text = mmap(NULL, file->st.st_size, PROT_READ,
+							MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (text == MAP_FAILED)
+		return -1;
+
+	uint32_t key = TRIGRAM(text);
+	for (off_t i = 3;; ++i) {
+		if (!(seen[key >> 6] & (1ULL << (key & 63)))) {
+			seen[key >> 6] |= 1ULL << (key & 63);
+			posting_add(table, key, id);
+			if (keys->count == keys->capacity) {
+				keys->capacity = keys->capacity ? keys->capacity * 2 : 4096;
+				keys->ids =
+					realloc(keys->ids, keys->capacity * sizeof(uint32_t));
+			}
+			keys->ids[keys->count++] = key;
+		}
+		if (i == file->st.st_size)
+			break;
+		key = (key << 8 | (unsigned char)text[i]) & (TRIGRAM_COUNT - 1);
+	}
+	munmap((void *)text, file->st.st_size);
+
+	// clear only the bits this file set, the bitmap is 2 MiB
+	for (uint32_t i = 0; i < keys->count; ++i)
+		seen[keys->ids[i] >> 6] = 0;
+	keys->count = 0;
+	return 0;
+}
+
+static int compare_build_name(const void *a, const void *b) {
+	return strcmp(((const BuildFile *)a)->name, ((const BuildFile *)b)->name);
+}
+
+static int compare_key(const void *a, const void *b) {
+	uint32_t x = ((const Posting *)a)->key, y = ((const Posting *)b)->key;
+	return (x > y) - (x < y);
+}
+
+static int compare_id(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static size_t align8(size_t offset) {
+	return (offset + 7) & ~(size_t)7;
+}
+
+static int write_index(int dir_fd, BuildFile *files, size_t file_count,
+					   PostingTable *table) {
+	// pack the postings and sort them by trigram
+	size_t trigram_count = 0, id_count = 0;
+	for (size_t i = 0; i < table->capacity; ++i) {
+		if (table->slots[i].count) {
+			table->slots[trigram_count++] = table->slots[i];
+			id_count += table->slots[i].count;
+		}
+	}
+	qsort(table->slots, trigram_count, sizeof(Posting), compare_key);
+
+	size_t names_size = 0;
+	for (size_t i = 0; i < file_count; ++i)
+		names_size += strlen(files[i].name) + 1;
+
+	IndexHeader header = { .file_count = file_count,
+						   .trigram_count = trigram_count };
+	memcpy(header.magic, FINDINDEX_MAGIC, sizeof(header.magic));
+	header.postings_offset =
+		align8(sizeof(IndexHeader) + file_count * sizeof(IndexFile) +
+			   trigram_count * sizeof(IndexTrigram));
+	header.names_offset =
+		align8(header.postings_offset + id_count * sizeof(uint32_t));
+
+	int fd = openat(dir_fd, FINDINDEX_FILE ".tmp",
+					O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	FILE *out = fd == -1 ? NULL : fdopen(fd, "w");
+	if (!out) {
+		perror("-findstringinall: " FINDINDEX_FILE);
+		if (fd != -1)
+			close(fd);
+		return -1;
+	}
+
+	fwrite(&header, sizeof(header), 1, out);
+	uint32_t name = 0;
+	for (size_t i = 0; i < file_count; ++i) {
+		IndexFile file = {
+			.inode = files[i].st.st_ino,
+			.size = files[i].st.st_size,
+			.mtime_sec = files[i].st.st_mtim.tv_sec,
+			.mtime_nsec = files[i].st.st_mtim.tv_nsec,
+			.name = name,
+		};
+		fwrite(&file, sizeof(file), 1, out);
+		name += strlen(files[i].name) + 1;
+	}
+	uint64_t first = 0;
+	for (size_t i = 0; i < trigram_count; ++i) {
+		IndexTrigram trigram = { table->slots[i].key, table->slots[i].count,
+								 first };
+		fwrite(&trigram, sizeof(trigram), 1, out);
+		first += table->slots[i].count;
+	}
+	static const char zeros[8];
+	fwrite(zeros, 1, header.postings_offset - ftell(out), out);
+	for (size_t i = 0; i < trigram_count; ++i) {
+		Posting *posting = &table->slots[i];
+		qsort(posting->ids, posting->count, sizeof(uint32_t), compare_id);
+		fwrite(posting->ids, sizeof(uint32_t), posting->count, out);
+	}
+	fwrite(zeros, 1, header.names_offset - ftell(out), out);
+	for (size_t i = 0; i < file_count; ++i)
+		fwrite(files[i].name, 1, strlen(files[i].name) + 1, out);
+
+	if (ferror(out) | (fclose(out) == EOF) ||
+		renameat(dir_fd, FINDINDEX_FILE ".tmp", dir_fd, FINDINDEX_FILE) ==
+			-1) {
+		perror("-findstringinall: " FINDINDEX_FILE);
+		unlinkat(dir_fd, FINDINDEX_FILE ".tmp", 0);
+		return -1;
+	}
+	return 0;
+}
+
+int findindex_build(const char *path) {
+	DIR *dir = opendir(path);
+	if (dir == NULL) {
+		perror("opendir");
+		return -1;
+	}
+	int dir_fd = dirfd(dir);
+
+	BuildFile *files = NULL;
+	size_t file_count = 0, capacity = 0;
+	struct dirent *entry;
+	struct stat st;
+	while ((entry = readdir(dir))) {
+		if (!find_string_selects(dir_fd, entry) ||
+			fstatat(dir_fd, entry->d_name, &st, 0) == -1)
+			continue;
+		if (file_count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			files = realloc(files, capacity * sizeof(BuildFile));
+		}
+		files[file_count++] =
+			(BuildFile){ strdup(entry->d_name), st, NO_FILE };
+	}
+	qsort(files, file_count, sizeof(BuildFile), compare_build_name);
+
+	// files unchanged since the old index take their ids from it
+	FindIndex *old = findindex_open(dir_fd);
+	uint32_t *new_ids = NULL;
+	if (old) {
+		new_ids = malloc((old->header->file_count + 1) * sizeof(uint32_t));
+		for (uint32_t i = 0; i < old->header->file_count; ++i)
+			new_ids[i] = NO_FILE;
+		for (size_t i = 0; i < file_count; ++i) {
+			uint32_t id = find_file(old, files[i].name);
+			if (id != NO_FILE && stat_matches(&old->files[id], &files[i].st)) {
+				files[i].old_id = id;
+				new_ids[id] = i;
+			}
+		}
+	}
+
+	PostingTable table = { calloc(1024, sizeof(Posting)), 1024, 0 };
+	if (old) {
+		for (uint32_t i = 0; i < old->header->trigram_count; ++i) {
+			const IndexTrigram *trigram = &old->trigrams[i];
+			const uint32_t *ids = old->postings + trigram->first;
+			for (uint32_t j = 0; j < trigram->count; ++j) {
+				if (ids[j] < old->header->file_count &&
+					new_ids[ids[j]] != NO_FILE)
+					posting_add(&table, trigram->key, new_ids[ids[j]]);
+			}
+		}
+	}
+
+	uint64_t *seen = calloc(TRIGRAM_COUNT / 64, sizeof(uint64_t));
+	Posting keys = { 0 };
+	size_t read_count = 0;
+	for (size_t i = 0; i < file_count; ++i) {
+		if (files[i].old_id != NO_FILE)
+			continue;
+		if (index_file(&table, dir_fd, &files[i], i, seen, &keys) == -1) {
+			fprintf(stderr, "-findstringinall: %s: %s\n", files[i].name,
+					strerror(errno));
+			// an mtime no file has, so queries always scan it
+			files[i].st.st_mtim.tv_nsec = -1;
+		}
+		read_count++;
+	}
+	free(keys.ids);
+	free(seen);
+
+	int result = write_index(dir_fd, files, file_count, &table);
+	if (result == 0)
+		printf("Indexed %zu files (%zu read, %zu unchanged), %zu trigrams\n",
+			   file_count, read_count, file_count - read_count, table.used);
+
+	// write_index packed the postings at the start of the table
+	for (size_t i = 0; i < table.used; ++i)
+		free(table.slots[i].ids);
+	free(table.slots);
+	for (size_t i = 0; i < file_count; ++i)
+		free(files[i].name);
+	free(files);
+	free(new_ids);
+	findindex_close(old);
+	closedir(dir);
+	return result;
+}
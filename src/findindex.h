@@ -0,0 +1,50 @@
+#ifndef FINDINDEX_H
+#define FINDINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+// index file, kept in the directory it covers
+#define FINDINDEX_FILE ".shellect_findindex"
+
+typedef struct FindIndex FindIndex;
+
+/**
+ * Builds or updates the trigram index of the ".txt" files in a directory.
+ * Files whose inode, size and mtime match the old index keep their
+ * trigrams, only new and changed files are read again. The index is
+ * written to a temporary file and renamed over the old one.
+ * @param path Directory to index.
+ * @return 0 on success, -1 on error.
+ */
+int findindex_build(const char *path);
+
+/**
+ * Maps the index of a directory, if it has one.
+ * @param dir_fd Directory the index was built for.
+ * @return The index, or NULL if there is none, it cannot be read or it
+ * is damaged. Searches then read every file, and findindex_build writes
+ * a new index from scratch.
+ */
+FindIndex *findindex_open(int dir_fd);
+
+/**
+ * Intersects the posting lists of every trigram of a pattern. Patterns
+ * shorter than a trigram select every file.
+ * @return false if the pattern cannot occur in any indexed file.
+ */
+bool findindex_query(FindIndex *index, const char *pattern,
+					 size_t pattern_len);
+
+/**
+ * Tells whether a file can be skipped by the last findindex_query: it is
+ * in the index, unchanged since it was indexed, and lacks a trigram of the
+ * pattern. Files that are new or changed are never skipped.
+ */
+bool findindex_excludes(const FindIndex *index, const char *name,
+						const struct stat *st);
+
+void findindex_close(FindIndex *index);
+
+#endif // FINDINDEX_H
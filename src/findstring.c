@@ -0,0 +1,353 @@
+#define _GNU_SOURCE
+#include "findstring.h"
+#include "findindex.h"
+#include "matcher.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+typedef struct {
+	char *name;
+	char *report; // output for this file, printed in directory order
+	size_t report_len, report_cap;
+	int error; // errno if the file could not be read
+	bool skip; // ruled out by the trigram index
+	bool done;
+} FileJob;
+
+typedef struct {
+	const FindStringOptions *options;
+	size_t pattern_len;
+	const Matcher *matcher; // for pattern lists and regular expressions
+	int dir_fd;
+	FileJob *files;
+	size_t file_count;
+	atomic_size_t next; // next file to be claimed by a worker
+	pthread_mutex_t lock;
+	pthread_cond_t file_done;
+} Search;
+
+const char *find_pattern(const char *text, size_t len, const char *pattern,
+						 size_t pattern_len) {
+	if (pattern_len == 0)
+		return text;
+	if (pattern_len > len)
+		return NULL;
+	if (pattern_len == 1)
+		return memchr(text, pattern[0], len);
+
+	const char first = pattern[0], last = pattern[pattern_len - 1];
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i first_bytes = _mm_set1_epi8(first);
+	const __m128i last_bytes = _mm_set1_epi8(last);
+	for (; i + pattern_len - 1 + 16 <= len; i += 16) {
+		__m128i starts = _mm_loadu_si128((const __m128i *)(text + i));
+		__m128i ends =
+			_mm_loadu_si128((const __m128i *)(text + i + pattern_len - 1));
+		unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(starts, first_bytes), _mm_cmpeq_epi8(ends, last_bytes)));
+		while (mask) {
+			size_t candidate = i + __builtin_ctz(mask);
+			if (memcmp(text + candidate + 1, pattern + 1, pattern_len - 2) == 0)
+				return text + candidate;
+			mask &= mask - 1;
+		}
+	}
+#endif
+	// the tail, or the whole text without SSE2
+	while (i + pattern_len <= len) {
+		const char *candidate =
+			memchr(text + i, first, len - pattern_len + 1 - i);
+		if (!candidate)
+			return NULL;
+		if (candidate[pattern_len - 1] == last &&
+			memcmp(candidate + 1, pattern + 1, pattern_len - 2) == 0)
+			return candidate;
+		i = candidate - text + 1;
+	}
+	return NULL;
+}
+
+static size_t count_lines(const char *text, size_t len) {
+	size_t count = 0, i = 0;
+#ifdef __SSE2__
+	const __m128i newlines = _mm_set1_epi8('\n');
+	for (; i + 16 <= len; i += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i *)(text + i));
+		count += __builtin_popcount(
+			_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newlines)));
+	}
+#endif
+	const char *end = text + len;
+	for (const char *c = text + i; (c = memchr(c, '\n', end - c)); ++c)
+		count++;
+	return count;
+}
+
+/**
+ * Finds the next match with the engine of the search.
+ * @param pattern Receives the index of the pattern that matched.
+ * @return A position inside the matching line, or NULL.
+ */
+static const char *find_next(const Search *search, const char *text,
+							 size_t len, size_t *pattern) {
+	if (search->matcher)
+		return matcher_find(search->matcher, text, len, pattern);
+	*pattern = 0;
+	return find_pattern(text, len, search->options->pattern,
+						search->pattern_len);
+}
+
+static void report(FileJob *job, const char *format, ...) {
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+
+	if (job->report_len + len + 1 > job->report_cap) {
+		job->report_cap = (job->report_len + len + 1) * 2;
+		job->report = realloc(job->report, job->report_cap);
+	}
+	va_start(args, format);
+	vsnprintf(job->report + job->report_len, len + 1, format, args);
+	va_end(args);
+	job->report_len += len;
+}
+
+/**
+ * Reports every line that contains the pattern, with its line number.
+ */
+static void report_all(const Search *search, FileJob *job, const char *text,
+					   size_t len) {
+	const char *end = text + len, *counted = text, *position = text;
+	size_t line = 1, pattern;
+	const char *match;
+	while (position < end &&
+		   (match = find_next(search, position, end - position, &pattern))) {
+		line += count_lines(counted, match - counted);
+		counted = match;
+
+		const char *line_start = memrchr(text, '\n', match - text);
+		line_start = line_start ? line_start + 1 : text;
+		const char *line_end = memchr(match, '\n', end - match);
+		if (!line_end)
+			line_end = end;
+		if (search->matcher)
+			report(job, "%s:%zu:%s:%.*s\n", job->name, line,
+				   search->options->patterns[pattern],
+				   (int)(line_end - line_start), line_start);
+		else
+			report(job, "%s:%zu:%.*s\n", job->name, line,
+				   (int)(line_end - line_start), line_start);
+		position = line_end + 1;
+	}
+}
+
+static void search_file(const Search *search, FileJob *job) {
+	if (job->skip) {
+		if (!search->options->all_matches)
+			report(job, "%s\tString not found in %s\n", job->name,
+				   job->name);
+		return;
+	}
+
+	int fd = openat(search->dir_fd, job->name, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		job->error = errno;
+		if (fd != -1)
+			close(fd);
+		return;
+	}
+
+	// a whole-file mapping lets matches straddle any line length. Only -a
+	// reads every file to the end, so only it populates the mapping up
+	// front, a first-match search stops at the first hit and leaves the
+	// rest of the file to readahead.
+	char *text = NULL;
+	if (st.st_size > 0) {
+		int populate = search->options->all_matches ? MAP_POPULATE : 0;
+		text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | populate, fd,
+					0);
+		if (text == MAP_FAILED) {
+			job->error = errno;
+			close(fd);
+			return;
+		}
+		if (!populate)
+			madvise(text, st.st_size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	if (search->options->all_matches) {
+		report_all(search, job, text, st.st_size);
+	} else {
+		size_t pattern;
+		const char *match = find_next(search, text, st.st_size, &pattern);
+		if (match && search->matcher)
+			report(job, "%s\tString found in %s at line %zu: %s\n",
+				   job->name, job->name, count_lines(text, match - text) + 1,
+				   search->options->patterns[pattern]);
+		else if (match)
+			report(job, "%s\tString found in %s at line %zu\n", job->name,
+				   job->name, count_lines(text, match - text) + 1);
+		else
+			report(job, "%s\tString not found in %s\n", job->name,
+				   job->name);
+	}
+
+	if (text)
+		munmap(text, st.st_size);
+}
+
+static void *search_worker(void *data) {
+	Search *search = data;
+	size_t i;
+	while ((i = atomic_fetch_add(&search->next, 1)) < search->file_count) {
+		search_file(search, &search->files[i]);
+		pthread_mutex_lock(&search->lock);
+		search->files[i].done = true;
+		pthread_cond_signal(&search->file_done);
+		pthread_mutex_unlock(&search->lock);
+	}
+	return NULL;
+}
+
+static void print_file(FileJob *job) {
+	if (job->error) {
+		fprintf(stderr, "-findstringinall: %s: %s\n", job->name,
+				strerror(job->error));
+	} else if (job->report_len) {
+		fwrite(job->report, 1, job->report_len, stdout);
+	}
+	free(job->report);
+	free(job->name);
+}
+
+bool find_string_selects(int dir_fd, const struct dirent *entry) {
+	if (!strstr(entry->d_name, ".txt"))
+		return false;
+	if (entry->d_type == DT_REG)
+		return true;
+	struct stat st;
+	return (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) &&
+		   fstatat(dir_fd, entry->d_name, &st, 0) == 0 && S_ISREG(st.st_mode);
+}
+
+static void list_files(DIR *dir, Search *search) {
+	size_t capacity = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir))) {
+		if (!find_string_selects(search->dir_fd, entry))
+			continue;
+		if (search->file_count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			search->files = realloc(search->files, capacity * sizeof(FileJob));
+		}
+		search->files[search->file_count++] =
+			(FileJob){ .name = strdup(entry->d_name) };
+	}
+}
+
+/**
+ * Marks the files the trigram index rules out. Only unchanged files are
+ * skipped, so the output is the same as without the index.
+ */
+static void apply_index(Search *search) {
+	FindIndex *index = findindex_open(search->dir_fd);
+	if (!index)
+		return;
+	findindex_query(index, search->options->pattern, search->pattern_len);
+	struct stat st;
+	for (size_t i = 0; i < search->file_count; ++i) {
+		FileJob *job = &search->files[i];
+		job->skip = fstatat(search->dir_fd, job->name, &st, 0) == 0 &&
+					findindex_excludes(index, job->name, &st);
+	}
+	findindex_close(index);
+}
+
+int find_string(const FindStringOptions *options) {
+	if (options->build_index)
+		return findindex_build(options->path);
+
+	const Matcher *matcher = NULL;
+	if (options->pattern_count > 0) {
+		const char *error;
+		matcher = matcher_compile(options->patterns, options->pattern_count,
+								  options->regex, &error);
+		if (!matcher) {
+			fprintf(stderr, "-findstringinall: %s\n", error);
+			return -1;
+		}
+	}
+
+	DIR *dir = opendir(options->path);
+	if (dir == NULL) {
+		perror("opendir");
+		return -1;
+	}
+
+	Search search = {
+		.options = options,
+		.pattern_len = options->pattern ? strlen(options->pattern) : 0,
+		.matcher = matcher,
+		.dir_fd = dirfd(dir),
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.file_done = PTHREAD_COND_INITIALIZER,
+	};
+	list_files(dir, &search);
+	if (!matcher)
+		apply_index(&search);
+
+	long threads = options->threads;
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > (long)search.file_count)
+		threads = search.file_count;
+
+	// files are claimed one at a time, so any number of started workers
+	// covers them all, and none at all searches them here
+	pthread_t *workers = malloc((threads > 1 ? threads : 1) * sizeof(pthread_t));
+	long started = 0;
+	while (threads > 1 && started < threads &&
+		   pthread_create(&workers[started], NULL, search_worker, &search) == 0)
+		started++;
+
+	if (started == 0) {
+		for (size_t i = 0; i < search.file_count; ++i) {
+			search_file(&search, &search.files[i]);
+			print_file(&search.files[i]);
+		}
+	} else {
+		// print each file as soon as it and every file before it is done
+		for (size_t i = 0; i < search.file_count; ++i) {
+			pthread_mutex_lock(&search.lock);
+			while (!search.files[i].done)
+				pthread_cond_wait(&search.file_done, &search.lock);
+			pthread_mutex_unlock(&search.lock);
+			print_file(&search.files[i]);
+		}
+
+		for (long i = 0; i < started; ++i)
+			pthread_join(workers[i], NULL);
+	}
+	free(workers);
+
+	free(search.files);
+	closedir(dir);
+	return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef FINDSTRING_H
+#define FINDSTRING_H
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+	const char *pattern; // String to search for
+	const char *const *patterns; // Or a list searched in a single pass
+	size_t pattern_count;
+	bool regex; // The patterns are regular expressions
+	const char *path; // Directory whose ".txt" files are searched
+	bool all_matches; // Report every matching line instead of the first
+	int threads; // Files searched at once, 0 for one per online CPU
+	bool build_index; // Build or update the trigram index instead
+} FindStringOptions;
+
+/**
+ * Searches every regular file with ".txt" in its name in a directory.
+ * Files are mmapped and handed out to a pool of threads, and the results
+ * are printed in directory order, so the output does not depend on the
+ * number of threads. If the directory has a trigram index, unchanged files
+ * that lack a trigram of the pattern are reported without being read.
+ * Pattern lists and regular expressions are compiled into one DFA, and
+ * every match names the pattern that matched.
+ * @param options FindStringOptions with the pattern and the search mode.
+ * @return 0 on success, -1 if the directory could not be read or the
+ * patterns could not be compiled.
+ */
+int find_string(const FindStringOptions *options);
+
+/**
+ * Tells whether a directory entry is searched: a regular file, or a
+ * symlink to one, with ".txt" in its name. d_type saves a stat per entry,
+ * only symlinks and file systems without it are stat'ed.
+ */
+bool find_string_selects(int dir_fd, const struct dirent *entry);
+
+/**
+ * Finds the first occurrence of a pattern. Candidate positions are those
+ * where both the first and the last byte of the pattern match, tested 16
+ * at a time where SSE2 is available, and only those are compared in full.
+ * @return Start of the match, or NULL if there is none.
+ */
+const char *find_pattern(const char *text, size_t len, const char *pattern,
+						 size_t pattern_len);
+
+#endif // FINDSTRING_H
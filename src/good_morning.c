@@ -22,24 +22,25 @@ void minutes_from_now_to_time(int minutes_from_now, char *out_time, size_t len)
 
 /**
  * Schedule an audio file to be played after a certain number of minutes.
- * @param minutes Minutes from now when the audio should play.
- * @param audio_path Path to the audio file.
+ * @param config Minutes from now and the path of the audio file to play.
  */
-void schedule_audio_playback(int minutes, const char *audio_path) {
+void schedule_audio_playback(const GoodMorningConfig *config) {
     char time_str[6]; // HH:MM
     char command[256];
 
     // Convert minutes to HH:MM for the 'at' command
-    minutes_from_now_to_time(minutes, time_str, sizeof(time_str));
+    minutes_from_now_to_time(config->minutes, time_str, sizeof(time_str));
 
     // Prepare the command to schedule the job using 'at'
     snprintf(command, sizeof(command), 
-             "echo 'mpg123 -q \"%s\"' | at %s", audio_path, time_str);
+             "echo 'mpg123 -q \"%s\"' | at %s", config->audio_path, time_str);
 
     // Execute the scheduling command
     system(command);
 }
 
+// The shell links this file in as a builtin and brings its own main
+#ifndef SHELLECT_BUILTIN
 int main(int argc, char *argv[]) {
     if (argc != 3) {
         fprintf(stderr, "Usage: %s <minutes> <path/to/audio>\n", argv[0]);
@@ -50,7 +51,7 @@ int main(int argc, char *argv[]) {
     config.minutes = atoi(argv[1]);
     config.audio_path = argv[2];
 
-    if (minutes <= 0) {
+    if (config.minutes <= 0) {
         fprintf(stderr, "Invalid number of minutes. Must be greater than 0.\n");
         return EXIT_FAILURE;
     }
@@ -61,3 +62,4 @@ int main(int argc, char *argv[]) {
 
     return EXIT_SUCCESS;
 }
+#endif // SHELLECT_BUILTIN
@@ -1,46 +1,502 @@
 #include "hexdump.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Input bytes formatted into the buffer before each write()
+#define HEXDUMP_BLOCK (256 * 1024)
+
+// Longest line: a 16 digit offset, 32 digits, 15 separators and the ASCII column
+#define HEXDUMP_LINE_MAX 96
+
+#define BYTES_PER_LINE 16
+
+// Two hex digits for every byte value, in memory order
+static uint16_t hex_pairs[256];
+
+static void init_hex_pairs(void) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < 256; ++i) {
+        char pair[2] = {digits[i >> 4], digits[i & 15]};
+        memcpy(&hex_pairs[i], pair, 2);
+    }
+}
+
+/**
+ * Converts 16 bytes to 32 hex digits.
+ */
+static inline void hex16(char *out, const unsigned char *in) {
+#ifdef __SSE2__
+    // split every byte into its two nibbles, interleaved high first, and
+    // map 0-9 to '0'-'9' and 10-15 to 'a'-'f'
+    __m128i bytes = _mm_loadu_si128((const __m128i *)in);
+    __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+    __m128i low = _mm_and_si128(bytes, mask);
+    __m128i nibbles[2] = {_mm_unpacklo_epi8(high, low), _mm_unpackhi_epi8(high, low)};
+    for (int i = 0; i < 2; ++i) {
+        __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles[i], _mm_set1_epi8(9)),
+                                        _mm_set1_epi8('a' - '0' - 10));
+        __m128i digits = _mm_add_epi8(_mm_add_epi8(nibbles[i], _mm_set1_epi8('0')), letters);
+        _mm_storeu_si128((__m128i *)(out + 16 * i), digits);
+    }
+#else
+    for (int i = 0; i < BYTES_PER_LINE; ++i) {
+        memcpy(out + 2 * i, &hex_pairs[in[i]], 2);
+    }
+#endif
+}
+
+/**
+ * Writes 16 bytes as printable characters, '.' for the others.
+ */
+static inline void ascii16(char *out, const unsigned char *in) {
+#ifdef __SSE2__
+    // signed compares: bytes from 0x80 up are negative and fail the first
+    __m128i bytes = _mm_loadu_si128((const __m128i *)in);
+    __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x1f)),
+                                      _mm_cmplt_epi8(bytes, _mm_set1_epi8(0x7f)));
+    __m128i dots = _mm_andnot_si128(printable, _mm_set1_epi8('.'));
+    _mm_storeu_si128((__m128i *)out, _mm_or_si128(_mm_and_si128(printable, bytes), dots));
+#else
+    for (int i = 0; i < BYTES_PER_LINE; ++i) {
+        out[i] = in[i] >= 0x20 && in[i] < 0x7f ? in[i] : '.';
+    }
+#endif
+}
+
+/**
+ * Writes the offset of a line as "%08lx: ".
+ */
+static inline char *format_offset(char *out, unsigned long offset) {
+    if (offset <= 0xffffffffUL) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            memcpy(out, &hex_pairs[(offset >> shift) & 0xff], 2);
+            out += 2;
+        }
+    } else {
+        int digits = 0;
+        for (unsigned long rest = offset; rest; rest >>= 4) {
+            digits++;
+        }
+        for (int i = digits - 1; i >= 0; --i) {
+            *out++ = "0123456789abcdef"[(offset >> (4 * i)) & 15];
+        }
+    }
+    *out++ = ':';
+    *out++ = ' ';
+    return out;
+}
+
+/**
+ * Formats one full line. Inlined with a constant group size, the copies
+ * of the groups unroll into a few fixed-size moves.
+ */
+static inline __attribute__((always_inline)) char *
+format_line(char *out, const unsigned char *in, unsigned long offset, int group, bool ascii) {
+    out = format_offset(out, offset);
+    if (group == BYTES_PER_LINE) {
+        hex16(out, in);
+        out += 2 * BYTES_PER_LINE;
+    } else {
+        char hex[2 * BYTES_PER_LINE];
+        hex16(hex, in);
+        for (int i = 0; i < BYTES_PER_LINE / group; ++i) {
+            if (i > 0) {
+                *out++ = ' ';
+            }
+            memcpy(out, hex + 2 * group * i, 2 * group);
+            out += 2 * group;
+        }
+    }
+    if (ascii) {
+        memcpy(out, "  |", 3);
+        ascii16(out + 3, in);
+        out[3 + BYTES_PER_LINE] = '|';
+        out += 4 + BYTES_PER_LINE;
+    }
+    *out++ = '\n';
+    return out;
+}
+
+// One formatting loop per group size
+#define DEFINE_FORMAT_LINES(group) \
+    static char *format_lines_##group(char *out, const unsigned char *in, size_t lines, \
+                                      unsigned long offset, bool ascii) { \
+        for (size_t i = 0; i < lines; ++i) { \
+            out = format_line(out, in + i * BYTES_PER_LINE, offset + i * BYTES_PER_LINE, \
+                              group, ascii); \
+        } \
+        return out; \
+    }
+
+DEFINE_FORMAT_LINES(1)
+DEFINE_FORMAT_LINES(2)
+DEFINE_FORMAT_LINES(4)
+DEFINE_FORMAT_LINES(8)
+DEFINE_FORMAT_LINES(16)
+
+typedef char *(*FormatLines)(char *out, const unsigned char *in, size_t lines,
+                             unsigned long offset, bool ascii);
+
+static FormatLines format_lines_for(int group) {
+    switch (group) {
+        case 2: return format_lines_2;
+        case 4: return format_lines_4;
+        case 8: return format_lines_8;
+        case 16: return format_lines_16;
+        default: return format_lines_1;
+    }
+}
+
+/**
+ * Formats the last, short line of a dump.
+ */
+static char *format_tail(char *out, const unsigned char *in, size_t len,
+                         unsigned long offset, int group, bool ascii) {
+    out = format_offset(out, offset);
+    char *hex_start = out;
+    for (size_t i = 0; i < len; ++i) {
+        if (i > 0 && i % group == 0) {
+            *out++ = ' ';
+        }
+        memcpy(out, &hex_pairs[in[i]], 2);
+        out += 2;
+    }
+    if (ascii) {
+        // pad the digits to the width of a full line
+        size_t width = 2 * BYTES_PER_LINE + BYTES_PER_LINE / group - 1;
+        memset(out, ' ', width - (out - hex_start));
+        out = hex_start + width;
+        memcpy(out, "  |", 3);
+        out += 3;
+        for (size_t i = 0; i < len; ++i) {
+            *out++ = in[i] >= 0x20 && in[i] < 0x7f ? in[i] : '.';
+        }
+        *out++ = '|';
+    }
+    *out++ = '\n';
+    return out;
+}
+
+static int write_all(const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, data, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * Formats a block of input, its full lines and a short last one if the
+ * block ends the dump.
+ * @return The end of the formatted text.
+ */
+static char *format_block(const HexdumpConfig *config, char *output, const unsigned char *in,
+                          size_t len, unsigned long offset) {
+    size_t lines = len / BYTES_PER_LINE;
+    char *end = format_lines_for(config->group_size)(output, in, lines, offset, config->ascii);
+    if (len % BYTES_PER_LINE) {
+        end = format_tail(end, in + lines * BYTES_PER_LINE, len % BYTES_PER_LINE,
+                          offset + lines * BYTES_PER_LINE, config->group_size, config->ascii);
+    }
+    return end;
+}
+
+// Size of the output buffer of one block
+#define OUTPUT_SIZE (HEXDUMP_BLOCK / BYTES_PER_LINE * HEXDUMP_LINE_MAX + HEXDUMP_LINE_MAX)
+
+// Formatted blocks waiting to be written, per thread
+#define SLOTS_PER_THREAD 2
+
+// A mapped window formatted by several threads, block by block. Blocks
+// are claimed in order and written in order by the calling thread, and
+// at most slot_count of them are formatted ahead of the output.
+typedef struct {
+    const HexdumpConfig *config;
+    const unsigned char *data;
+    size_t size;
+    unsigned long offset;       // Offset of data[0] in the file
+    size_t block_count;
+    size_t slot_count;
+    char **outputs;             // One buffer per slot
+    size_t *lengths;            // Formatted length per slot, 0 while not ready
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t done;
+    size_t next_block;          // Next block to claim
+    size_t written;             // Blocks written so far
+    bool failed;                // The output could not be written
+} ParallelDump;
+
+static void *format_worker(void *data) {
+    ParallelDump *dump = data;
+    pthread_mutex_lock(&dump->lock);
+    for (;;) {
+        while (!dump->failed && dump->next_block < dump->block_count &&
+               dump->next_block >= dump->written + dump->slot_count) {
+            pthread_cond_wait(&dump->done, &dump->lock);
+        }
+        if (dump->failed || dump->next_block >= dump->block_count) {
+            break;
+        }
+        size_t block = dump->next_block++;
+        pthread_mutex_unlock(&dump->lock);
+
+        size_t start = block * HEXDUMP_BLOCK;
+        size_t len = dump->size - start < HEXDUMP_BLOCK ? dump->size - start : HEXDUMP_BLOCK;
+        size_t slot = block % dump->slot_count;
+        char *end = format_block(dump->config, dump->outputs[slot], dump->data + start, len,
+                                 dump->offset + start);
+
+        pthread_mutex_lock(&dump->lock);
+        dump->lengths[slot] = end - dump->outputs[slot];
+        pthread_cond_broadcast(&dump->ready);
+    }
+    pthread_mutex_unlock(&dump->lock);
+    return NULL;
+}
+
+/**
+ * Dumps a mapped window with a pool of threads. Blocks start at multiples
+ * of HEXDUMP_BLOCK from the window, so the lines and their offsets are
+ * the same as in a serial dump. The blocks are shared by the threads that
+ * could be started, however many that is.
+ * @return false if no thread could be started, before anything was written.
+ */
+static bool dump_parallel(const HexdumpConfig *config, const unsigned char *data, size_t size,
+                          unsigned long offset, int threads) {
+    ParallelDump dump = {
+        .config = config,
+        .data = data,
+        .size = size,
+        .offset = offset,
+        .block_count = (size + HEXDUMP_BLOCK - 1) / HEXDUMP_BLOCK,
+        .slot_count = (size_t)threads * SLOTS_PER_THREAD,
+    };
+    dump.outputs = malloc(dump.slot_count * sizeof(char *));
+    dump.lengths = calloc(dump.slot_count, sizeof(size_t));
+    for (size_t i = 0; i < dump.slot_count; ++i) {
+        dump.outputs[i] = malloc(OUTPUT_SIZE);
+    }
+    pthread_mutex_init(&dump.lock, NULL);
+    pthread_cond_init(&dump.ready, NULL);
+    pthread_cond_init(&dump.done, NULL);
+
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    int started = 0;
+    while (started < threads &&
+           pthread_create(&ids[started], NULL, format_worker, &dump) == 0) {
+        started++;
+    }
+
+    pthread_mutex_lock(&dump.lock);
+    for (size_t block = 0; started > 0 && block < dump.block_count && !dump.failed; ++block) {
+        size_t slot = block % dump.slot_count;
+        while (dump.lengths[slot] == 0) {
+            pthread_cond_wait(&dump.ready, &dump.lock);
+        }
+        pthread_mutex_unlock(&dump.lock);
+        int result = write_all(dump.outputs[slot], dump.lengths[slot]);
+        pthread_mutex_lock(&dump.lock);
+        dump.failed = result == -1;
+        dump.lengths[slot] = 0;
+        dump.written++;
+        pthread_cond_broadcast(&dump.done);
+    }
+    pthread_mutex_unlock(&dump.lock);
+
+    for (int i = 0; i < started; ++i) {
+        pthread_join(ids[i], NULL);
+    }
+    free(ids);
+    pthread_mutex_destroy(&dump.lock);
+    pthread_cond_destroy(&dump.ready);
+    pthread_cond_destroy(&dump.done);
+    for (size_t i = 0; i < dump.slot_count; ++i) {
+        free(dump.outputs[i]);
+    }
+    free(dump.outputs);
+    free(dump.lengths);
+    return started > 0;
+}
+
+/**
+ * Dumps the window of a regular file through a mapping of just that part.
+ */
+static void dump_mapped(const HexdumpConfig *config, int fd, unsigned long offset, size_t size) {
+    // mappings start on a page boundary
+    unsigned long start = offset & ~((unsigned long)sysconf(_SC_PAGESIZE) - 1);
+    size_t map_size = offset - start + size;
+    const unsigned char *map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, start);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+    madvise((void *)map, map_size, MADV_SEQUENTIAL);
+    const unsigned char *data = map + (offset - start);
+
+    long threads = config->threads;
+    if (threads <= 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    size_t blocks = (size + HEXDUMP_BLOCK - 1) / HEXDUMP_BLOCK;
+    bool dumped = threads > 1 && blocks > 1 &&
+                  dump_parallel(config, data, size, offset,
+                                threads < (long)blocks ? threads : (long)blocks);
+    if (!dumped) {
+        char *output = malloc(OUTPUT_SIZE);
+        for (size_t done = 0; done < size; done += HEXDUMP_BLOCK) {
+            size_t len = size - done < HEXDUMP_BLOCK ? size - done : HEXDUMP_BLOCK;
+            char *end = format_block(config, output, data + done, len, offset + done);
+            if (write_all(output, end - output) == -1) {
+                break;
+            }
+        }
+        free(output);
+    }
+    munmap((void *)map, map_size);
+}
+
+/**
+ * Dumps input that cannot be mapped, read in large blocks. The window's
+ * start is skipped with lseek where possible and read otherwise.
+ */
+static void dump_stream(const HexdumpConfig *config, int fd) {
+    unsigned long offset = config->offset;
+    unsigned long long left = config->length < 0 ? ~0ULL : (unsigned long long)config->length;
+    unsigned char *input = malloc(HEXDUMP_BLOCK);
+    char *output = malloc(OUTPUT_SIZE);
+
+    unsigned long skip = offset;
+    if (skip && lseek(fd, skip, SEEK_CUR) != -1) {
+        skip = 0;
+    }
+
+    size_t buffered = 0; // a partial line is kept for the next read
+    while (left > 0) {
+        size_t want = HEXDUMP_BLOCK - buffered;
+        if (skip > 0 && want > skip) {
+            want = skip;
+        } else if (skip == 0 && want > left) {
+            want = left;
+        }
+        ssize_t bytes_read = read(fd, input + buffered, want);
+        if (bytes_read == 0) {
+            break;
+        }
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("read");
+            break;
+        }
+        if (skip > 0) {
+            skip -= bytes_read;
+            continue;
+        }
+
+        buffered += bytes_read;
+        left -= bytes_read;
+        size_t lines = buffered / BYTES_PER_LINE;
+        if (lines) {
+            char *end = format_block(config, output, input, lines * BYTES_PER_LINE, offset);
+            if (write_all(output, end - output) == -1) {
+                buffered = 0;
+                break;
+            }
+        }
+        offset += lines * BYTES_PER_LINE;
+        buffered -= lines * BYTES_PER_LINE;
+        memmove(input, input + lines * BYTES_PER_LINE, buffered);
+    }
+    if (buffered) {
+        char *end = format_block(config, output, input, buffered, offset);
+        write_all(output, end - output);
+    }
+    free(input);
+    free(output);
+}
 
 void hexdump(const HexdumpConfig *config) {
     int fd = STDIN_FILENO;
     if (config->filename) {
-        fd = open(config->filename, O_RDONLY);
+        fd = open(config->filename, O_RDONLY | O_CLOEXEC);
         if (fd == -1) {
             perror("open");
             return;
         }
     }
 
-    unsigned char buffer[16];
-    ssize_t bytes_read;
-    unsigned long offset = 0;
+    init_hex_pairs();
+    fflush(stdout); // the dump is written to the fd directly
 
-    // Loop to read and print the file content in hexadecimal format
-    while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
-        printf("%08lx: ", offset);
-        for (int i = 0; i < bytes_read; ++i) {
-            if (i > 0 && i % config->group_size == 0) printf(" ");
-            printf("%02x", buffer[i]);
+    // the window of a regular file is mapped, other input is streamed
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        unsigned long size = st.st_size;
+        if (config->offset < size) {
+            size -= config->offset;
+            if (config->length >= 0 && (unsigned long long)config->length < size) {
+                size = config->length;
+            }
+            if (size > 0) {
+                dump_mapped(config, fd, config->offset, size);
+            }
         }
-        printf("\n");
-        offset += bytes_read;
+    } else {
+        dump_stream(config, fd);
     }
 
     if (fd != STDIN_FILENO) close(fd);
 }
 
+// The shell links this file in as a builtin and brings its own main
+#ifndef SHELLECT_BUILTIN
 int main(int argc, char *argv[]) {
     HexdumpConfig config;
     config.group_size = 1; // Default group size
     config.filename = NULL;
+    config.ascii = 0;
+    config.offset = 0;
+    config.length = -1;
+    config.threads = 0;
 
     int opt;
-    while ((opt = getopt(argc, argv, "g:")) != -1) {
+    while ((opt = getopt(argc, argv, "g:as:n:j:")) != -1) {
         switch (opt) {
+            case 'a':
+                config.ascii = 1;
+                break;
+            case 's':
+                config.offset = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                config.length = strtoll(optarg, NULL, 0);
+                break;
+            case 'j':
+                config.threads = atoi(optarg);
+                break;
             case 'g':
                 config.group_size = atoi(optarg);
                 if (config.group_size <= 0 || config.group_size > 16 || (config.group_size & (config.group_size - 1)) != 0) {
@@ -49,7 +505,7 @@ int main(int argc, char *argv[]) {
                 }
                 break;
             default: /* '?' */
-                fprintf(stderr, "Usage: %s [-g group_size] [file]\n", argv[0]);
+                fprintf(stderr, "Usage: %s [-a] [-g group_size] [-s offset] [-n length] [-j threads] [file]\n", argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
@@ -61,3 +517,4 @@ int main(int argc, char *argv[]) {
     hexdump(&config);
     return 0;
 }
+#endif // SHELLECT_BUILTIN
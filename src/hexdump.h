@@ -5,8 +5,22 @@
 typedef struct {
     int group_size;       // The number of bytes to group together in the output
     const char *filename; // The name of the file to be dumped. If NULL, reads from STDIN.
+    int ascii;            // Flag to add a column with the printable characters
+    unsigned long offset; // First byte to dump
+    long long length;     // Bytes to dump, -1 for up to the end
+    int threads;          // Threads formatting a regular file, 0 for one per online CPU
 } HexdumpConfig;
 
+/**
+ * Dumps a file as lines of 16 bytes in hex, prefixed with their offset.
+ * Regular files are mmapped and other input is read in large blocks. The
+ * lines of each block are formatted into one buffer, 16 bytes at a time,
+ * by a loop specialized for the group size, and written with one write().
+ * For a regular file only the window from offset is mapped, and large
+ * windows are formatted by several threads block by block and written
+ * in order, so the output is the same as with one thread.
+ * @param config HexdumpConfig with the file, the group size and the columns.
+ */
 void hexdump(const HexdumpConfig *config);
 
 #endif // HEXDUMP_H
@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+#include "history.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Entries kept in memory, older ones stay only in the file
+#define HISTORY_CAPACITY (1 << 17)
+
+typedef struct {
+	const char *text; // into the mapped file, or malloc'ed when owned
+	uint32_t len;
+	bool owned;
+} HistoryEntry;
+
+// Trigrams are keyed by the low 7 bits of their bytes. ASCII trigrams get
+// a list of their own, others may share one, which only adds candidates
+// that the final memmem rejects.
+#define TRIGRAM_BITS 21
+
+// Ids of the entries containing one trigram, oldest first
+typedef struct {
+	uint32_t count;
+	uint32_t capacity;
+	uint32_t *ids;
+} Posting;
+
+static HistoryEntry ring[HISTORY_CAPACITY];
+static long first_id, end_id;
+
+static int history_fd = -1;
+static char *history_path;
+
+static Posting *postings; // indexed by trigram, only touched pages are used
+static long indexed_end; // entries below this id are in the index
+static long index_start; // oldest id the index was built from
+
+static uint32_t trigram_at(const char *text) {
+	return (uint32_t)(text[0] & 0x7f) << 14 | (text[1] & 0x7f) << 7 |
+		   (text[2] & 0x7f);
+}
+
+static void drop_index() {
+	if (!postings)
+		return;
+	for (size_t i = 0; i < 1 << TRIGRAM_BITS; ++i)
+		free(postings[i].ids);
+	free(postings);
+	postings = NULL;
+}
+
+/**
+ * Brings the trigram index up to date with the ring. The index is built
+ * on the first search and then extended by the entries added since.
+ */
+static void update_index() {
+	// once as many entries as the ring holds have been evicted, the dead
+	// ids outweigh the live ones and the index is rebuilt
+	if (first_id - index_start >= HISTORY_CAPACITY) {
+		drop_index();
+		indexed_end = first_id;
+	}
+	if (indexed_end < first_id)
+		indexed_end = first_id;
+	if (!postings) {
+		postings = calloc(1 << TRIGRAM_BITS, sizeof(Posting));
+		index_start = indexed_end;
+	}
+
+	for (; indexed_end < end_id; ++indexed_end) {
+		HistoryEntry *entry = &ring[indexed_end % HISTORY_CAPACITY];
+		uint32_t id = indexed_end;
+		for (uint32_t i = 0; i + 3 <= entry->len; ++i) {
+			Posting *posting = &postings[trigram_at(entry->text + i)];
+			// a trigram seen twice in one entry is listed once
+			if (posting->count && posting->ids[posting->count - 1] == id)
+				continue;
+			if (posting->count == posting->capacity) {
+				posting->capacity = posting->capacity ? posting->capacity * 2
+													  : 4;
+				posting->ids = realloc(posting->ids,
+									   posting->capacity * sizeof(uint32_t));
+			}
+			posting->ids[posting->count++] = id;
+		}
+	}
+}
+
+static void push_entry(const char *text, size_t len, bool owned) {
+	HistoryEntry *entry = &ring[end_id % HISTORY_CAPACITY];
+	if (end_id - first_id == HISTORY_CAPACITY) {
+		if (entry->owned)
+			free((char *)entry->text);
+		first_id++;
+	}
+	entry->text = text;
+	entry->len = len;
+	entry->owned = owned;
+	end_id++;
+}
+
+void history_load(const char *path) {
+	history_path = strdup(path);
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return;
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || st.st_size == 0) {
+		close(fd);
+		return;
+	}
+
+	// the mapping stays for the whole session, entries point into it
+	char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return;
+
+	// walk back from the end for the last HISTORY_CAPACITY lines only
+	const char *end = map + st.st_size;
+	const char *start = end;
+	if (start > map && start[-1] == '\n')
+		start--;
+	for (long lines = 0; lines < HISTORY_CAPACITY && start > map; ++lines) {
+		const char *newline = memrchr(map, '\n', start - map);
+		start = newline ? newline : map;
+	}
+	if (start > map)
+		start++; // past the newline that ends the line before
+
+	while (start < end) {
+		const char *newline = memchr(start, '\n', end - start);
+		const char *line_end = newline ? newline : end;
+		if (line_end > start)
+			push_entry(start, line_end - start, false);
+		start = line_end + 1;
+	}
+}
+
+void history_add(const char *line) {
+	size_t len = strlen(line);
+	if (len == 0)
+		return;
+
+	if (end_id > first_id) {
+		size_t last_len;
+		const char *last = history_get(end_id - 1, &last_len);
+		if (last_len == len && memcmp(last, line, len) == 0)
+			return;
+	}
+
+	push_entry(strdup(line), len, true);
+
+	if (history_fd == -1 && history_path)
+		history_fd = open(history_path,
+						  O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	if (history_fd != -1) {
+		// one append per line, the file is never rewritten
+		struct iovec iov[2] = { { (void *)line, len }, { "\n", 1 } };
+		if (writev(history_fd, iov, 2) == -1) {
+			close(history_fd);
+			history_fd = -1;
+			free(history_path);
+			history_path = NULL;
+		}
+	}
+}
+
+long history_first() {
+	return first_id;
+}
+
+long history_end() {
+	return end_id;
+}
+
+const char *history_get(long id, size_t *len) {
+	HistoryEntry *entry = &ring[id % HISTORY_CAPACITY];
+	*len = entry->len;
+	return entry->text;
+}
+
+static bool entry_contains(long id, const char *query, size_t len) {
+	size_t entry_len;
+	const char *text = history_get(id, &entry_len);
+	return memmem(text, entry_len, query, len) != NULL;
+}
+
+long history_search(const char *query, size_t len, long before) {
+	if (before > end_id)
+		before = end_id;
+
+	if (len < 3) {
+		// too short for the index, the newest entries usually match anyway
+		for (long id = before - 1; id >= first_id; --id) {
+			if (entry_contains(id, query, len))
+				return id;
+		}
+		return -1;
+	}
+
+	update_index();
+
+	// the rarest trigram of the query gives the fewest candidates
+	Posting *rarest = NULL;
+	for (size_t i = 0; i + 3 <= len; ++i) {
+		Posting *posting = &postings[trigram_at(query + i)];
+		if (!rarest || posting->count < rarest->count)
+			rarest = posting;
+	}
+
+	for (uint32_t i = rarest->count; i-- > 0;) {
+		long id = rarest->ids[i];
+		if (id < first_id)
+			break;
+		if (id < before && entry_contains(id, query, len))
+			return id;
+	}
+	return -1;
+}
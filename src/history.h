@@ -0,0 +1,41 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+
+/**
+ * Maps the history file and takes its most recent lines into the history.
+ * Only the tail of the file is read, so start time does not grow with it.
+ * @param path History file, created on the first history_add.
+ */
+void history_load(const char *path);
+
+/**
+ * Adds a line to the history and appends it to the history file. Empty
+ * lines and repeats of the newest entry are skipped.
+ */
+void history_add(const char *line);
+
+/**
+ * Ids of the oldest and one past the newest entry. Ids grow by one per
+ * entry and are never reused, entries older than history_first() have been
+ * dropped from the ring.
+ */
+long history_first();
+long history_end();
+
+/**
+ * Returns the text of an entry, which is not NUL terminated.
+ * @param id Id between history_first() and history_end().
+ * @param len Receives the length of the text.
+ */
+const char *history_get(long id, size_t *len);
+
+/**
+ * Finds the newest entry older than before that contains query. Queries of
+ * three or more bytes only look at entries that share their rarest trigram.
+ * @return Id of the entry, or -1 if no entry matches.
+ */
+long history_search(const char *query, size_t len, long before);
+
+#endif // HISTORY_H
@@ -0,0 +1,432 @@
+#define _GNU_SOURCE
+#include "jobs.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct Job {
+	int id;
+	pid_t pgid;
+	int stage_count;
+	pid_t *pids; // -1 once reaped, 0 or -1 if the stage never started
+	int *statuses; // Last wait status of each stage
+	bool *stage_stopped;
+	int alive; // Processes not reaped yet
+	int running; // Of those, the ones not stopped
+	bool reported; // The current state was reported
+	Job *next_changed; // In the list of jobs to report
+	bool changed;
+	char *text; // Command line shown for the job
+};
+
+// a process of a job, found by pid
+typedef struct {
+	pid_t pid; // 0 for a free slot
+	Job *job;
+	int stage;
+} ProcessSlot;
+
+static int signal_fd = -1;
+static bool report_changes;
+
+// jobs by number, the numbers go up from the last one in use
+static Job **jobs;
+static int job_capacity;
+static int last_id;
+static int current_id, previous_id; // %+ and %-
+
+// processes by pid, open addressing with linear probing
+static ProcessSlot *processes;
+static size_t process_capacity, process_count;
+
+// jobs that finished or stopped since the last report
+static Job *changed_jobs;
+
+void jobs_init(bool report) {
+	report_changes = report;
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+static size_t hash_pid(pid_t pid) {
+	return (size_t)pid * 0x9E3779B97F4A7C15ULL;
+}
+
+static void insert_process(pid_t pid, Job *job, int stage) {
+	if ((process_count + 1) * 2 > process_capacity) {
+		ProcessSlot *old = processes;
+		size_t old_capacity = process_capacity;
+		process_capacity = process_capacity ? process_capacity * 2 : 64;
+		processes = calloc(process_capacity, sizeof(ProcessSlot));
+		process_count = 0;
+		for (size_t i = 0; i < old_capacity; ++i)
+			if (old[i].pid)
+				insert_process(old[i].pid, old[i].job, old[i].stage);
+		free(old);
+	}
+	size_t mask = process_capacity - 1, i = hash_pid(pid) & mask;
+	while (processes[i].pid)
+		i = (i + 1) & mask;
+	processes[i] = (ProcessSlot){ pid, job, stage };
+	process_count++;
+}
+
+static ProcessSlot *find_process(pid_t pid) {
+	if (!process_capacity)
+		return NULL;
+	size_t mask = process_capacity - 1;
+	for (size_t i = hash_pid(pid) & mask; processes[i].pid; i = (i + 1) & mask)
+		if (processes[i].pid == pid)
+			return &processes[i];
+	return NULL;
+}
+
+/**
+ * Frees a slot and moves the entries after it back, so that lookups
+ * never need tombstones.
+ */
+static void remove_process(ProcessSlot *slot) {
+	size_t mask = process_capacity - 1;
+	size_t hole = slot - processes;
+	for (size_t i = (hole + 1) & mask; processes[i].pid; i = (i + 1) & mask) {
+		size_t home = hash_pid(processes[i].pid) & mask;
+		// the entry may fill the hole if its home is not between them
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			processes[hole] = processes[i];
+			hole = i;
+		}
+	}
+	processes[hole].pid = 0;
+	process_count--;
+}
+
+static void mark_changed(Job *job) {
+	job->reported = false;
+	if (!job->changed) {
+		job->changed = true;
+		job->next_changed = changed_jobs;
+		changed_jobs = job;
+	}
+}
+
+static void set_current(int id) {
+	if (id != current_id) {
+		previous_id = current_id;
+		current_id = id;
+	}
+}
+
+/**
+ * Builds the text of a job from the words of its stages.
+ */
+static char *job_text(const struct command_t *command) {
+	size_t len = 1;
+	for (const struct command_t *stage = command; stage; stage = stage->next)
+		for (int i = 0; i < stage->arg_count - 1; ++i)
+			len += strlen(stage->args[i]) + 3;
+	char *text = malloc(len), *end = text;
+	*end = '\0';
+	for (const struct command_t *stage = command; stage; stage = stage->next) {
+		if (stage != command)
+			end = stpcpy(end, " | ");
+		for (int i = 0; i < stage->arg_count - 1; ++i)
+			end += sprintf(end, i ? " %s" : "%s", stage->args[i]);
+	}
+	return text;
+}
+
+int jobs_add(const struct command_t *command, PipelineStatus *status) {
+	if (last_id + 1 >= job_capacity) {
+		job_capacity = job_capacity ? job_capacity * 2 : 16;
+		jobs = realloc(jobs, job_capacity * sizeof(Job *));
+	}
+
+	Job *job = calloc(1, sizeof(Job));
+	job->id = ++last_id;
+	job->pgid = status->pgid;
+	job->stage_count = status->stage_count;
+	job->pids = status->pids;
+	job->statuses = malloc(status->stage_count * sizeof(int));
+	memcpy(job->statuses, status->statuses, status->stage_count * sizeof(int));
+	job->stage_stopped = calloc(status->stage_count, sizeof(bool));
+	job->text = job_text(command);
+	status->pids = NULL;
+
+	for (int i = 0; i < job->stage_count; ++i) {
+		if (job->pids[i] <= 0)
+			continue;
+		job->alive++;
+		if (status->stopped && WIFSTOPPED(job->statuses[i]))
+			job->stage_stopped[i] = true;
+		else
+			job->running++;
+		insert_process(job->pids[i], job, i);
+	}
+	jobs[job->id] = job;
+	set_current(job->id);
+	if (status->stopped)
+		mark_changed(job);
+	return job->id;
+}
+
+static void remove_job(Job *job) {
+	for (int i = 0; i < job->stage_count; ++i) {
+		ProcessSlot *slot = job->pids[i] > 0 ? find_process(job->pids[i]) : NULL;
+		if (slot)
+			remove_process(slot);
+	}
+	jobs[job->id] = NULL;
+	if (job->id == current_id) {
+		current_id = previous_id;
+		previous_id = 0;
+	} else if (job->id == previous_id) {
+		previous_id = 0;
+	}
+	while (last_id > 0 && !jobs[last_id])
+		last_id--;
+
+	free(job->pids);
+	free(job->statuses);
+	free(job->stage_stopped);
+	free(job->text);
+	free(job);
+}
+
+/**
+ * Applies a wait status to the process it is for, if it is in a job.
+ */
+static void update_process(pid_t pid, int status) {
+	ProcessSlot *slot = find_process(pid);
+	if (!slot)
+		return;
+	Job *job = slot->job;
+	int stage = slot->stage;
+
+	if (WIFSTOPPED(status)) {
+		if (!job->stage_stopped[stage]) {
+			job->stage_stopped[stage] = true;
+			job->running--;
+		}
+		job->statuses[stage] = status;
+		if (job->running == 0) {
+			set_current(job->id);
+			mark_changed(job);
+		}
+	} else if (WIFCONTINUED(status)) {
+		if (job->stage_stopped[stage]) {
+			job->stage_stopped[stage] = false;
+			job->running++;
+		}
+	} else {
+		if (job->stage_stopped[stage])
+			job->stage_stopped[stage] = false;
+		else
+			job->running--;
+		job->alive--;
+		job->statuses[stage] = status;
+		job->pids[stage] = -1;
+		remove_process(slot);
+		if (job->alive == 0)
+			mark_changed(job);
+	}
+}
+
+int jobs_fd() {
+	return signal_fd;
+}
+
+void jobs_reap() {
+	if (signal_fd != -1) {
+		// SIGCHLDs coalesce, one pending signal can stand for many children
+		struct signalfd_siginfo info[16];
+		bool pending = false;
+		while (read(signal_fd, info, sizeof(info)) > 0)
+			pending = true;
+		if (!pending)
+			return;
+	}
+
+	int status;
+	pid_t pid;
+	while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0)
+		update_process(pid, status);
+}
+
+/**
+ * Describes the state of a job, like bash does.
+ */
+static const char *job_state(const Job *job, char *buffer, size_t size) {
+	if (job->alive > 0)
+		return job->running > 0 ? "Running" : "Stopped";
+	int status = job->statuses[job->stage_count - 1];
+	if (WIFSIGNALED(status))
+		return strsignal(WTERMSIG(status));
+	if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+		snprintf(buffer, size, "Exit %d", WEXITSTATUS(status));
+		return buffer;
+	}
+	return "Done";
+}
+
+static void print_job(const Job *job) {
+	char buffer[32];
+	char mark = job->id == current_id ? '+' : job->id == previous_id ? '-' : ' ';
+	printf("[%d]%c  %-24s%s%s\n", job->id, mark,
+		   job_state(job, buffer, sizeof(buffer)), job->text,
+		   job->alive > 0 && job->running > 0 ? " &" : "");
+}
+
+void jobs_notify() {
+	jobs_reap();
+	Job *job = changed_jobs;
+	changed_jobs = NULL;
+	while (job) {
+		Job *next = job->next_changed;
+		job->changed = false;
+		if (!job->reported && report_changes) {
+			print_job(job);
+			job->reported = true;
+		}
+		if (job->alive == 0)
+			remove_job(job);
+		job = next;
+	}
+	fflush(stdout);
+}
+
+Job *jobs_find(const char *spec) {
+	int id = 0;
+	if (spec[0] == '%') {
+		if (strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0 || spec[1] == '\0')
+			id = current_id;
+		else if (strcmp(spec, "%-") == 0)
+			id = previous_id;
+		else
+			id = atoi(spec + 1);
+		return id > 0 && id <= last_id ? jobs[id] : NULL;
+	}
+	ProcessSlot *slot = find_process(atoi(spec));
+	return slot ? slot->job : NULL;
+}
+
+void jobs_print() {
+	jobs_reap();
+	for (int id = 1; id <= last_id; ++id) {
+		if (jobs[id]) {
+			print_job(jobs[id]);
+			jobs[id]->reported = true;
+		}
+	}
+	// finished jobs are shown once, then forgotten
+	jobs_notify();
+}
+
+/**
+ * Blocks until one child changes state and applies it.
+ * @return false if there are no children left to wait for.
+ */
+static bool wait_child() {
+	int status;
+	pid_t pid = waitpid(-1, &status, WUNTRACED);
+	if (pid == -1)
+		return errno == EINTR;
+	update_process(pid, status);
+	return true;
+}
+
+static int last_status(const Job *job) {
+	return job->statuses[job->stage_count - 1];
+}
+
+int jobs_wait(Job *job) {
+	if (job) {
+		while (job->running > 0 && wait_child())
+			;
+		int status = last_status(job);
+		if (job->alive == 0) {
+			// a job that was waited for is not reported again
+			job->reported = true;
+			jobs_notify();
+		}
+		return status;
+	}
+
+	int status = 0;
+	for (int id = 1; id <= last_id; ++id) {
+		Job *next = jobs[id];
+		if (!next)
+			continue;
+		while (next->running > 0 && wait_child())
+			;
+		status = last_status(next);
+		if (next->alive == 0)
+			next->reported = true;
+	}
+	jobs_notify();
+	return status;
+}
+
+int jobs_foreground(Job *job) {
+	printf("%s\n", job->text);
+	fflush(stdout);
+	bool interactive = isatty(STDIN_FILENO) &&
+					   tcgetpgrp(STDIN_FILENO) == getpgrp();
+	if (interactive)
+		give_terminal(job->pgid);
+	if (job->running < job->alive)
+		killpg(job->pgid, SIGCONT);
+	for (int i = 0; i < job->stage_count; ++i) {
+		if (job->stage_stopped[i]) {
+			job->stage_stopped[i] = false;
+			job->running++;
+		}
+	}
+
+	while (job->running > 0 && wait_child())
+		;
+	if (interactive)
+		give_terminal(getpgrp());
+
+	int status = last_status(job);
+	if (job->alive == 0) {
+		if (WIFSIGNALED(status) && WTERMSIG(status) != SIGINT &&
+			WTERMSIG(status) != SIGPIPE)
+			fprintf(stderr, "-%s: %s: %s\n", sysname, job->text,
+					strsignal(WTERMSIG(status)));
+		job->reported = true;
+	} else {
+		printf("\n"); // the report goes below the echoed ^Z
+	}
+	jobs_notify();
+	return status;
+}
+
+void jobs_background(Job *job) {
+	if (job->running < job->alive)
+		killpg(job->pgid, SIGCONT);
+	for (int i = 0; i < job->stage_count; ++i) {
+		if (job->stage_stopped[i]) {
+			job->stage_stopped[i] = false;
+			job->running++;
+		}
+	}
+	set_current(job->id);
+	printf("[%d]+ %s &\n", job->id, job->text);
+}
+
+int jobs_signal(Job *job, int sig) {
+	if (killpg(job->pgid, sig) == -1)
+		return -1;
+	// a stopped job only acts on these once it runs again
+	if (job->running < job->alive && (sig == SIGTERM || sig == SIGHUP))
+		killpg(job->pgid, SIGCONT);
+	return 0;
+}
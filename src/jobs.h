@@ -0,0 +1,86 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include "pipeline.h"
+#include "shell.h"
+#include <stdbool.h>
+
+typedef struct Job Job;
+
+/**
+ * Blocks SIGCHLD and opens a signalfd for it, so that finished children
+ * are noticed with a read instead of a handler. Children get SIGCHLD
+ * unblocked again when they start.
+ * @param report Print finished and stopped jobs in jobs_notify, false
+ * for scripts.
+ */
+void jobs_init(bool report);
+
+/**
+ * Adds a pipeline that runs in the background or was stopped to the job
+ * table. The job takes over the pids of status.
+ * @param command First stage, used to show the job.
+ * @param status Pipeline started by run_pipeline.
+ * @return The job's number.
+ */
+int jobs_add(const struct command_t *command, PipelineStatus *status);
+
+/**
+ * The signalfd SIGCHLD is read from, for callers that wait on other
+ * input, such as the line editor at the prompt. When it is readable
+ * jobs_reap should be called.
+ * @return The fd, or -1 if there is none.
+ */
+int jobs_fd();
+
+/**
+ * Reaps every child that changed state since the last call. It only
+ * calls waitpid when the signalfd has a SIGCHLD pending, and prints
+ * nothing, the changes are reported by jobs_notify.
+ */
+void jobs_reap();
+
+/**
+ * Reaps, then reports and forgets the jobs that finished since the last
+ * prompt. Called before each prompt, and after each line of a script.
+ */
+void jobs_notify();
+
+/**
+ * Finds a job from "%n", "%%", "%+", "%-" or the pid of one of its
+ * processes.
+ * @return The job, or NULL if there is none.
+ */
+Job *jobs_find(const char *spec);
+
+/**
+ * Prints every job with its number and state, like "jobs" in bash.
+ */
+void jobs_print();
+
+/**
+ * Waits until a job, or every job if job is NULL, finishes or stops.
+ * Finished jobs are reported and forgotten.
+ * @return The wait status of the job's last process.
+ */
+int jobs_wait(Job *job);
+
+/**
+ * Moves a job to the foreground: gives it the terminal, continues it if
+ * it is stopped and waits for it.
+ * @return The wait status of the job's last process.
+ */
+int jobs_foreground(Job *job);
+
+/**
+ * Continues a stopped job in the background.
+ */
+void jobs_background(Job *job);
+
+/**
+ * Sends a signal to every process of a job.
+ * @return 0 on success, -1 with errno set on error.
+ */
+int jobs_signal(Job *job, int sig);
+
+#endif // JOBS_H
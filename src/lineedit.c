@@ -0,0 +1,633 @@
+#include "lineedit.h"
+#include "complete.h"
+#include "history.h"
+#include "jobs.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h> // termios, TCSANOW, ECHO, ICANON
+#include <unistd.h>
+
+// Bytes requested from the terminal per read()
+#define LINEEDIT_READ_SIZE 4096
+
+// Control keys
+#define KEY_CTRL(key) ((key) & 0x1f)
+#define KEY_ESCAPE 27
+#define KEY_BACKSPACE 127
+
+typedef struct {
+	char *data;
+	size_t len;
+	size_t cap;
+} Buffer;
+
+static struct termios cooked_termios;
+static bool have_termios, raw;
+
+static char input[LINEEDIT_READ_SIZE];
+static size_t input_pos, input_len;
+
+static Buffer line; // line being edited, always NUL terminated on return
+static size_t cursor; // byte offset of the cursor in line
+static Buffer saved; // edited line while history entries are shown
+static long history_id; // entry shown, history_end() for the edited line
+static Buffer query; // reverse search query
+static Buffer output; // one refresh worth of terminal output
+
+static void reserve(Buffer *buffer, size_t len) {
+	if (len <= buffer->cap)
+		return;
+	size_t cap = buffer->cap ? buffer->cap : 256;
+	while (cap < len)
+		cap *= 2;
+	buffer->data = realloc(buffer->data, cap);
+	if (!buffer->data) {
+		perror("realloc");
+		exit(EXIT_FAILURE);
+	}
+	buffer->cap = cap;
+}
+
+static void append(Buffer *buffer, const char *data, size_t len) {
+	reserve(buffer, buffer->len + len + 1);
+	memcpy(buffer->data + buffer->len, data, len);
+	buffer->len += len;
+	buffer->data[buffer->len] = 0;
+}
+
+static void insert(Buffer *buffer, size_t pos, const char *data, size_t len) {
+	reserve(buffer, buffer->len + len + 1);
+	memmove(buffer->data + pos + len, buffer->data + pos, buffer->len - pos);
+	memcpy(buffer->data + pos, data, len);
+	buffer->len += len;
+	buffer->data[buffer->len] = 0;
+}
+
+static void erase(Buffer *buffer, size_t pos, size_t len) {
+	memmove(buffer->data + pos, buffer->data + pos + len,
+			buffer->len - pos - len);
+	buffer->len -= len;
+	buffer->data[buffer->len] = 0;
+}
+
+static void copy(Buffer *to, const Buffer *from) {
+	to->len = 0;
+	append(to, from->data ? from->data : "", from->len);
+}
+
+static void write_all(const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(STDOUT_FILENO, data, len);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return;
+		data += n;
+		len -= n;
+	}
+}
+
+/**
+ * Waits until stdin is readable, reaping the children that finish in the
+ * meantime so background jobs do not stay zombies while the shell sits at
+ * the prompt. They are reported at the next prompt.
+ */
+static void wait_for_input() {
+	struct pollfd fds[] = {
+		{ .fd = STDIN_FILENO, .events = POLLIN },
+		{ .fd = jobs_fd(), .events = POLLIN }, // ignored when -1
+	};
+	for (;;) {
+		int ready = poll(fds, 2, -1);
+		if (ready == -1 && errno != EINTR)
+			return; // let read() report it
+		if (ready > 0 && fds[1].revents & POLLIN)
+			jobs_reap();
+		if (ready > 0 && fds[0].revents)
+			return;
+	}
+}
+
+/**
+ * Returns the next input byte, reading a new block when the current one is
+ * used up, or -1 at the end of the input.
+ */
+static int read_byte() {
+	if (input_pos == input_len) {
+		ssize_t n;
+		wait_for_input();
+		while ((n = read(STDIN_FILENO, input, sizeof(input))) == -1 &&
+			   errno == EINTR)
+			;
+		if (n <= 0)
+			return -1;
+		input_pos = 0;
+		input_len = n;
+	}
+	return (unsigned char)input[input_pos++];
+}
+
+static bool enable_raw() {
+	if (raw)
+		return true;
+	if (!isatty(STDIN_FILENO))
+		return false;
+
+	if (!have_termios) {
+		if (tcgetattr(STDIN_FILENO, &cooked_termios) == -1)
+			return false;
+		have_termios = true;
+	}
+
+	struct termios raw_termios = cooked_termios;
+	// no line buffering, no echo, and keys like Ctrl-C arrive as bytes
+	raw_termios.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+	raw_termios.c_iflag &= ~(ICRNL | IXON);
+	raw_termios.c_cc[VMIN] = 1;
+	raw_termios.c_cc[VTIME] = 0;
+	// TCSADRAIN keeps keys typed while a command was running
+	if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw_termios) == -1)
+		return false;
+	raw = true;
+	return true;
+}
+
+void lineedit_restore() {
+	if (raw) {
+		tcsetattr(STDIN_FILENO, TCSADRAIN, &cooked_termios);
+		raw = false;
+	}
+}
+
+static bool is_continuation(char c) {
+	return (c & 0xc0) == 0x80;
+}
+
+/**
+ * Number of terminal columns taken by n bytes of UTF-8 text.
+ */
+static size_t width(const char *text, size_t n) {
+	size_t columns = 0;
+	for (size_t i = 0; i < n; ++i)
+		columns += !is_continuation(text[i]);
+	return columns;
+}
+
+static size_t previous_char(size_t pos) {
+	while (pos > 0 && is_continuation(line.data[--pos]))
+		;
+	return pos;
+}
+
+static size_t next_char(size_t pos) {
+	while (pos < line.len && is_continuation(line.data[++pos]))
+		;
+	return pos;
+}
+
+static size_t terminal_columns() {
+	struct winsize ws;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0)
+		return 80;
+	return ws.ws_col;
+}
+
+/**
+ * Redraws the prompt and the line with a single write. Lines wider than the
+ * terminal scroll horizontally so that the cursor stays visible.
+ */
+static void refresh(const char *prompt) {
+	size_t columns = terminal_columns();
+	size_t prompt_len = strlen(prompt);
+	size_t prompt_width = width(prompt, prompt_len);
+	size_t available =
+		columns > prompt_width + 1 ? columns - prompt_width - 1 : 1;
+
+	size_t start = 0;
+	while (width(line.data + start, cursor - start) > available)
+		start = next_char(start);
+	size_t end = start;
+	while (end < line.len && width(line.data + start, end - start) < available)
+		end = next_char(end);
+
+	char move[32];
+	int move_len = snprintf(move, sizeof(move), "\r\x1b[%zuC",
+							prompt_width + width(line.data + start,
+												 cursor - start));
+
+	output.len = 0;
+	append(&output, "\r", 1);
+	append(&output, prompt, prompt_len);
+	append(&output, line.data + start, end - start);
+	append(&output, "\x1b[0K", 4); // clear what is left of the old line
+	append(&output, move, move_len);
+	write_all(output.data, output.len);
+}
+
+/**
+ * Replaces the line with a history entry. Moving past the newest entry
+ * brings back the line that was being edited.
+ */
+static void show_history(long id) {
+	if (id < history_first() || id > history_end() || id == history_id)
+		return;
+
+	if (history_id == history_end())
+		copy(&saved, &line);
+	history_id = id;
+
+	if (id == history_end()) {
+		copy(&line, &saved);
+	} else {
+		size_t len;
+		const char *text = history_get(id, &len);
+		line.len = 0;
+		append(&line, text, len);
+	}
+	cursor = line.len;
+}
+
+static void search_refresh(long match, bool failed) {
+	size_t len = 0;
+	const char *text = match == -1 ? "" : history_get(match, &len);
+	const char *label =
+		failed ? "\r(failed reverse-i-search)`" : "\r(reverse-i-search)`";
+
+	output.len = 0;
+	append(&output, label, strlen(label));
+	append(&output, query.data, query.len);
+	append(&output, "': ", 3);
+	append(&output, text, len);
+	append(&output, "\x1b[0K", 4);
+	write_all(output.data, output.len);
+}
+
+/**
+ * Ctrl-R: searches the history while the query is typed. Ctrl-R again
+ * goes to the next older match, Ctrl-G or Ctrl-C give the line back, and
+ * any other key, Enter included, takes the match into the line and is then
+ * handled by the editor.
+ */
+static void reverse_search() {
+	long match = -1;
+	bool failed = false;
+
+	query.len = 0;
+	reserve(&query, 1);
+	query.data[0] = 0;
+
+	while (1) {
+		search_refresh(match, failed);
+
+		int c = read_byte();
+		long from = match == -1 ? history_end() : match;
+		if (c == -1 || c == KEY_CTRL('g') || c == KEY_CTRL('c')) {
+			return;
+		} else if (c == KEY_CTRL('r')) {
+			// next older match
+		} else if (c == KEY_BACKSPACE || c == KEY_CTRL('h')) {
+			while (query.len > 0 && is_continuation(query.data[--query.len]))
+				;
+			query.data[query.len] = 0;
+			from = history_end();
+		} else if (c >= ' ') {
+			char byte = c;
+			append(&query, &byte, 1);
+			from = match == -1 ? history_end() : match + 1;
+		} else {
+			// handled by the editor once the match is in the line
+			input_pos--;
+			break;
+		}
+
+		long id = query.len ? history_search(query.data, query.len, from)
+							: -1;
+		failed = query.len && id == -1;
+		if (id != -1 || !query.len)
+			match = id;
+	}
+
+	if (match != -1)
+		show_history(match);
+}
+
+/**
+ * Decodes the rest of an escape sequence, CSI ("ESC [") or SS3 ("ESC O"),
+ * and applies the key it stands for. Unknown sequences are consumed whole
+ * so none of their bytes end up in the line.
+ */
+static void handle_escape() {
+	int c = read_byte();
+	int param = 0, final;
+
+	if (c == '[') {
+		// parameter bytes, then intermediate bytes, then the final byte
+		while ((final = read_byte()) >= '0' && final <= '?') {
+			if (final >= '0' && final <= '9')
+				param = param * 10 + final - '0';
+		}
+		while (final >= ' ' && final <= '/')
+			final = read_byte();
+	} else if (c == 'O') {
+		final = read_byte();
+	} else {
+		return; // Alt+key, not bound
+	}
+
+	switch (final) {
+	case 'A':
+		show_history(history_id - 1);
+		break;
+	case 'B':
+		show_history(history_id + 1);
+		break;
+	case 'C':
+		cursor = next_char(cursor);
+		break;
+	case 'D':
+		cursor = previous_char(cursor);
+		break;
+	case 'H':
+		cursor = 0;
+		break;
+	case 'F':
+		cursor = line.len;
+		break;
+	case '~':
+		if (param == 1 || param == 7)
+			cursor = 0;
+		else if (param == 4 || param == 8)
+			cursor = line.len;
+		else if (param == 3 && cursor < line.len)
+			erase(&line, cursor, next_char(cursor) - cursor);
+		break;
+	}
+}
+
+static bool is_word_break(char c) {
+	return c == ' ' || c == '\t' || c == '|' || c == '&' || c == '<' ||
+		   c == '>';
+}
+
+/**
+ * Prints every candidate below the line in columns, like other shells do
+ * on a second Tab. The caller redraws the prompt afterwards.
+ * @param skip Leading bytes shared by every candidate that are not shown,
+ * the directory part of a path.
+ */
+static void list_matches(const Completion *completion, size_t skip) {
+	size_t longest = 0;
+	for (size_t i = 0; i < completion->count; ++i) {
+		size_t len = strlen(completion->matches[i] + skip);
+		if (len > longest)
+			longest = len;
+	}
+	size_t column_width = longest + 2;
+	size_t columns = terminal_columns() / column_width;
+	if (columns == 0)
+		columns = 1;
+	size_t rows = (completion->count + columns - 1) / columns;
+
+	output.len = 0;
+	append(&output, "\r\n", 2);
+	for (size_t row = 0; row < rows; ++row) {
+		// fill columns top to bottom so that the list reads sorted
+		for (size_t column = 0; column < columns; ++column) {
+			size_t i = column * rows + row;
+			if (i >= completion->count)
+				break;
+			size_t len = strlen(completion->matches[i] + skip);
+			append(&output, completion->matches[i] + skip, len);
+			if (column + 1 < columns && i + rows < completion->count)
+				for (; len < column_width; ++len)
+					append(&output, " ", 1);
+		}
+		append(&output, "\r\n", 2);
+	}
+	write_all(output.data, output.len);
+}
+
+/**
+ * Completes the word before the cursor. A single candidate replaces the
+ * word, several extend it to their longest common prefix and are listed
+ * when Tab is pressed twice in a row.
+ * @param list true on the second Tab in a row.
+ */
+static void complete(bool list) {
+	// scan from the start of the line to find the word and whether it
+	// names a command, honouring quotes and backslashes like the parser
+	size_t start = 0;
+	bool command = true, in_word = false;
+	char quote = 0;
+	for (size_t i = 0; i < cursor; ++i) {
+		char c = line.data[i];
+		if (quote) {
+			if (c == quote)
+				quote = 0;
+		} else if (c == '\\') {
+			i++;
+		} else if (c == '\'' || c == '"') {
+			quote = c;
+		} else if (is_word_break(c)) {
+			if (in_word)
+				command = false;
+			if (c == '|' || c == '&')
+				command = true;
+			in_word = false;
+			start = i + 1;
+			continue;
+		}
+		in_word = true;
+	}
+
+	Buffer word = { 0 };
+	reserve(&word, cursor - start + 1);
+	for (size_t i = start; i < cursor; ++i) {
+		char c = line.data[i];
+		if (c == '\'' || c == '"')
+			continue;
+		if (c == '\\' && i + 1 < cursor)
+			c = line.data[++i];
+		append(&word, &c, 1);
+	}
+	word.data[word.len] = 0;
+
+	Completion completion = { 0 };
+	complete_word(word.data, command, &completion);
+
+	if (completion.count == 0) {
+		write_all("\a", 1);
+	} else {
+		// longest common prefix of the sorted candidates
+		const char *first = completion.matches[0];
+		const char *last = completion.matches[completion.count - 1];
+		size_t common = 0;
+		while (first[common] && first[common] == last[common])
+			common++;
+
+		if (common > word.len || completion.count == 1) {
+			Buffer replacement = { 0 };
+			for (size_t i = 0; i < common; ++i) {
+				if (is_word_break(first[i]) || first[i] == '\\' ||
+					first[i] == '\'' || first[i] == '"')
+					append(&replacement, "\\", 1);
+				append(&replacement, first + i, 1);
+			}
+			if (completion.count == 1 && first[common - 1] != '/')
+				append(&replacement, " ", 1);
+			erase(&line, start, cursor - start);
+			insert(&line, start, replacement.data, replacement.len);
+			cursor = start + replacement.len;
+			free(replacement.data);
+		} else if (list) {
+			const char *slash = strrchr(word.data, '/');
+			list_matches(&completion, slash ? slash + 1 - word.data : 0);
+		} else {
+			write_all("\a", 1);
+		}
+	}
+	free_completion(&completion);
+	free(word.data);
+}
+
+static char *accept_line() {
+	write_all("\r\n", 2);
+	return line.data;
+}
+
+/**
+ * Reads a line without editing, when the input is not a terminal.
+ */
+static char *read_plain(const char *prompt) {
+	int c;
+	while ((c = read_byte()) != -1 && c != '\n') {
+		char byte = c;
+		append(&line, &byte, 1);
+	}
+	if (c == -1 && line.len == 0)
+		return NULL;
+
+	output.len = 0;
+	append(&output, prompt, strlen(prompt));
+	append(&output, line.data, line.len);
+	append(&output, "\n", 1);
+	write_all(output.data, output.len);
+	return line.data;
+}
+
+char *lineedit_read(const char *prompt) {
+	// output of the last command must come before the prompt
+	fflush(stdout);
+
+	line.len = 0;
+	cursor = 0;
+	reserve(&line, 1);
+	line.data[0] = 0;
+	history_id = history_end();
+
+	if (!enable_raw())
+		return read_plain(prompt);
+
+	bool dirty = true;
+	int previous_key = 0;
+	while (1) {
+		// while pasted input is still buffered, redraw only once at the end
+		if (dirty && input_pos == input_len) {
+			refresh(prompt);
+			dirty = false;
+		}
+
+		int c = read_byte();
+		if (c == -1)
+			return line.len ? accept_line() : NULL;
+		dirty = true;
+		bool second_tab = c == '\t' && previous_key == '\t';
+		previous_key = c;
+
+		switch (c) {
+		case '\r':
+		case '\n':
+			refresh(prompt);
+			return accept_line();
+		case '\t':
+			complete(second_tab);
+			break;
+		case KEY_CTRL('a'):
+			cursor = 0;
+			break;
+		case KEY_CTRL('e'):
+			cursor = line.len;
+			break;
+		case KEY_CTRL('b'):
+			cursor = previous_char(cursor);
+			break;
+		case KEY_CTRL('f'):
+			cursor = next_char(cursor);
+			break;
+		case KEY_CTRL('c'):
+			write_all("^C\r\n", 4);
+			line.len = 0;
+			line.data[0] = 0;
+			return line.data;
+		case KEY_CTRL('d'):
+			if (line.len == 0) {
+				write_all("\r\n", 2);
+				return NULL;
+			}
+			if (cursor < line.len)
+				erase(&line, cursor, next_char(cursor) - cursor);
+			break;
+		case KEY_CTRL('h'):
+		case KEY_BACKSPACE:
+			if (cursor > 0) {
+				size_t start = previous_char(cursor);
+				erase(&line, start, cursor - start);
+				cursor = start;
+			}
+			break;
+		case KEY_CTRL('k'):
+			erase(&line, cursor, line.len - cursor);
+			break;
+		case KEY_CTRL('u'):
+			erase(&line, 0, cursor);
+			cursor = 0;
+			break;
+		case KEY_CTRL('w'): {
+			size_t start = cursor;
+			while (start > 0 && line.data[start - 1] == ' ')
+				start--;
+			while (start > 0 && line.data[start - 1] != ' ')
+				start--;
+			erase(&line, start, cursor - start);
+			cursor = start;
+			break;
+		}
+		case KEY_CTRL('r'):
+			reverse_search();
+			break;
+		case KEY_CTRL('l'):
+			write_all("\x1b[H\x1b[2J", 7);
+			break;
+		case KEY_ESCAPE:
+			handle_escape();
+			break;
+		default:
+			if (c < ' ')
+				break; // other control keys are not bound
+			// take every printable byte that is already buffered at once
+			size_t start = input_pos - 1, end = input_pos;
+			while (end < input_len && (unsigned char)input[end] >= ' ' &&
+				   (unsigned char)input[end] != KEY_BACKSPACE)
+				end++;
+			insert(&line, cursor, input + start, end - start);
+			cursor += end - start;
+			input_pos = end;
+			break;
+		}
+	}
+}
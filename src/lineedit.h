@@ -0,0 +1,21 @@
+#ifndef LINEEDIT_H
+#define LINEEDIT_H
+
+/**
+ * Reads one line from the user. On a terminal the line can be edited, and
+ * input is read in blocks, so pasted text is taken in a single pass.
+ * Otherwise the prompt and the line are echoed, as the shell always did.
+ * @param prompt Prompt text, printed before the line.
+ * @return The line without its newline, valid until the next call, or
+ * NULL at the end of the input.
+ */
+char *lineedit_read(const char *prompt);
+
+/**
+ * Puts the terminal back into the mode it had before the first
+ * lineedit_read. The terminal is only switched back to raw mode by the
+ * next lineedit_read, so lines that run no command never touch it.
+ */
+void lineedit_restore();
+
+#endif // LINEEDIT_H
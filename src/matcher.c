@@ -0,0 +1,685 @@
+#include "matcher.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the transition table is states * 256 entries of 4 bytes
+#define MATCHER_MAX_STATES 65536
+
+#define NO_MATCH UINT32_MAX
+#define NO_STATE UINT32_MAX
+
+// set in a transition whose target state reports a match
+#define ACCEPTING 0x80000000U
+
+struct Matcher {
+	// next[state * 256 + byte] is the target state * 256, so the scan
+	// loop needs no multiplication, with ACCEPTING set if it matches
+	uint32_t *next;
+	uint32_t *accept; // pattern reported on entering the state
+	uint32_t *eol_accept; // pattern reported if a newline or the end follows
+	bool *at_newline; // entered on a newline that ends a match with $
+	bool stays_at_start[256]; // bytes that lead from the start state to itself
+	size_t state_count, capacity;
+
+	// what the cached matcher was compiled from
+	char **patterns;
+	size_t count;
+	bool regex;
+};
+
+static Matcher *cached;
+
+static uint32_t add_state(Matcher *matcher) {
+	if (matcher->state_count == matcher->capacity) {
+		matcher->capacity = matcher->capacity ? matcher->capacity * 2 : 64;
+		matcher->next = realloc(matcher->next, matcher->capacity * 256 *
+												   sizeof(uint32_t));
+		matcher->accept =
+			realloc(matcher->accept, matcher->capacity * sizeof(uint32_t));
+		matcher->eol_accept =
+			realloc(matcher->eol_accept, matcher->capacity * sizeof(uint32_t));
+		matcher->at_newline =
+			realloc(matcher->at_newline, matcher->capacity * sizeof(bool));
+	}
+	uint32_t state = matcher->state_count++;
+	for (int c = 0; c < 256; ++c)
+		matcher->next[state * 256 + c] = NO_STATE;
+	matcher->accept[state] = NO_MATCH;
+	matcher->eol_accept[state] = NO_MATCH;
+	matcher->at_newline[state] = false;
+	return state;
+}
+
+static void free_matcher(Matcher *matcher) {
+	if (!matcher)
+		return;
+	free(matcher->next);
+	free(matcher->accept);
+	free(matcher->eol_accept);
+	free(matcher->at_newline);
+	for (size_t i = 0; i < matcher->count; ++i)
+		free(matcher->patterns[i]);
+	free(matcher->patterns);
+	free(matcher);
+}
+
+/**
+ * Builds the Aho-Corasick automaton of literal patterns as a full DFA:
+ * missing trie edges are resolved through the failure links up front, so
+ * scanning takes one table lookup per byte.
+ */
+static bool build_aho_corasick(Matcher *matcher, const char *const *patterns,
+							   size_t count, const char **error) {
+	add_state(matcher);
+	for (size_t i = 0; i < count; ++i) {
+		uint32_t state = 0;
+		for (const unsigned char *c = (const unsigned char *)patterns[i]; *c;
+			 ++c) {
+			uint32_t *edge = &matcher->next[state * 256 + *c];
+			if (*edge == NO_STATE) {
+				if (matcher->state_count == MATCHER_MAX_STATES) {
+					*error = "too many patterns";
+					return false;
+				}
+				uint32_t child = add_state(matcher);
+				// add_state may have moved the table
+				edge = &matcher->next[state * 256 + *c];
+				*edge = child;
+			}
+			state = *edge;
+		}
+		if (matcher->accept[state] == NO_MATCH)
+			matcher->accept[state] = i;
+	}
+
+	// breadth first, so the failure state of a state is always done first
+	uint32_t *fail = malloc(matcher->state_count * sizeof(uint32_t));
+	uint32_t *queue = malloc(matcher->state_count * sizeof(uint32_t));
+	size_t head = 0, tail = 0;
+	for (int c = 0; c < 256; ++c) {
+		uint32_t child = matcher->next[c];
+		if (child == NO_STATE) {
+			matcher->next[c] = 0;
+		} else {
+			fail[child] = 0;
+			queue[tail++] = child;
+		}
+	}
+	while (head < tail) {
+		uint32_t state = queue[head++];
+		// report the patterns that end here as a suffix of a longer one
+		if (matcher->accept[state] == NO_MATCH ||
+			(matcher->accept[fail[state]] != NO_MATCH &&
+			 matcher->accept[fail[state]] < matcher->accept[state]))
+			matcher->accept[state] = matcher->accept[fail[state]];
+		for (int c = 0; c < 256; ++c) {
+			uint32_t *edge = &matcher->next[state * 256 + c];
+			uint32_t fallback = matcher->next[fail[state] * 256 + c];
+			if (*edge == NO_STATE) {
+				*edge = fallback;
+			} else {
+				fail[*edge] = fallback;
+				queue[tail++] = *edge;
+			}
+		}
+	}
+	free(fail);
+	free(queue);
+	return true;
+}
+
+typedef enum {
+	NFA_EMPTY,
+	NFA_SPLIT,
+	NFA_BYTES,
+	NFA_LINE_START, // ^
+	NFA_LINE_END, // $
+	NFA_MATCH,
+} NfaType;
+
+typedef struct {
+	NfaType type;
+	int out, out2;
+	uint32_t pattern; // for NFA_MATCH
+	uint64_t bytes[4]; // for NFA_BYTES
+} NfaNode;
+
+typedef struct {
+	NfaNode *nodes;
+	size_t count, capacity;
+	const char *input;
+	const char *error;
+} Nfa;
+
+// part of the NFA with one entry and one NFA_EMPTY exit to patch
+typedef struct {
+	int start, end;
+} Fragment;
+
+static int add_node(Nfa *nfa, NfaType type) {
+	if (nfa->count == nfa->capacity) {
+		nfa->capacity = nfa->capacity ? nfa->capacity * 2 : 64;
+		nfa->nodes = realloc(nfa->nodes, nfa->capacity * sizeof(NfaNode));
+	}
+	nfa->nodes[nfa->count] = (NfaNode){ .type = type, .out = -1, .out2 = -1 };
+	return nfa->count++;
+}
+
+static Fragment empty_fragment(Nfa *nfa) {
+	int node = add_node(nfa, NFA_EMPTY);
+	return (Fragment){ node, node };
+}
+
+/**
+ * Makes a fragment of a node that leads to a new exit.
+ */
+static Fragment single(Nfa *nfa, NfaType type, const uint64_t *bytes) {
+	int node = add_node(nfa, type);
+	if (bytes)
+		memcpy(nfa->nodes[node].bytes, bytes, sizeof(nfa->nodes[node].bytes));
+	int end = add_node(nfa, NFA_EMPTY);
+	nfa->nodes[node].out = end;
+	return (Fragment){ node, end };
+}
+
+static void add_byte(uint64_t *bytes, unsigned char c) {
+	bytes[c >> 6] |= 1ULL << (c & 63);
+}
+
+static void add_range(uint64_t *bytes, unsigned char from, unsigned char to) {
+	for (unsigned c = from; c <= to; ++c)
+		add_byte(bytes, c);
+}
+
+/**
+ * Adds the bytes of \d, \w or \s, or the escaped byte itself.
+ */
+static void add_escape(uint64_t *bytes, char c) {
+	switch (c) {
+	case 'd':
+		add_range(bytes, '0', '9');
+		break;
+	case 'w':
+		add_range(bytes, 'a', 'z');
+		add_range(bytes, 'A', 'Z');
+		add_range(bytes, '0', '9');
+		add_byte(bytes, '_');
+		break;
+	case 's':
+		add_byte(bytes, ' ');
+		add_byte(bytes, '\t');
+		add_byte(bytes, '\r');
+		add_byte(bytes, '\v');
+		add_byte(bytes, '\f');
+		break;
+	default:
+		add_byte(bytes, c);
+		break;
+	}
+}
+
+static Fragment parse_alternation(Nfa *nfa);
+
+static Fragment parse_class(Nfa *nfa) {
+	uint64_t bytes[4] = { 0 };
+	bool negate = *nfa->input == '^';
+	if (negate)
+		nfa->input++;
+	// a ] right after [ or [^ is a literal
+	for (bool first = true; first || *nfa->input != ']'; first = false) {
+		char c = *nfa->input++;
+		if (!c) {
+			nfa->error = "missing ]";
+			return empty_fragment(nfa);
+		}
+		if (c == '\\' && *nfa->input) {
+			add_escape(bytes, *nfa->input++);
+		} else if (nfa->input[0] == '-' && nfa->input[1] &&
+				   nfa->input[1] != ']') {
+			unsigned char to = nfa->input[1];
+			nfa->input += 2;
+			if ((unsigned char)c <= to)
+				add_range(bytes, c, to);
+		} else {
+			add_byte(bytes, c);
+		}
+	}
+	nfa->input++; // ]
+	if (negate) {
+		for (int i = 0; i < 4; ++i)
+			bytes[i] = ~bytes[i];
+	}
+	// no class matches a newline, so matches stay within a line
+	bytes['\n' >> 6] &= ~(1ULL << ('\n' & 63));
+	return single(nfa, NFA_BYTES, bytes);
+}
+
+static Fragment parse_atom(Nfa *nfa) {
+	uint64_t bytes[4] = { 0 };
+	char c = *nfa->input++;
+	switch (c) {
+	case '(': {
+		Fragment inner = parse_alternation(nfa);
+		if (*nfa->input != ')') {
+			nfa->error = "missing )";
+			return inner;
+		}
+		nfa->input++;
+		return inner;
+	}
+	case '[':
+		return parse_class(nfa);
+	case '.':
+		add_range(bytes, 0, 255);
+		bytes['\n' >> 6] &= ~(1ULL << ('\n' & 63));
+		return single(nfa, NFA_BYTES, bytes);
+	case '^':
+		return single(nfa, NFA_LINE_START, NULL);
+	case '$':
+		return single(nfa, NFA_LINE_END, NULL);
+	case '*':
+	case '+':
+	case '?':
+		nfa->error = "nothing to repeat";
+		return empty_fragment(nfa);
+	case '\\':
+		if (!*nfa->input) {
+			nfa->error = "trailing backslash";
+			return empty_fragment(nfa);
+		}
+		add_escape(bytes, *nfa->input++);
+		return single(nfa, NFA_BYTES, bytes);
+	default:
+		add_byte(bytes, c);
+		return single(nfa, NFA_BYTES, bytes);
+	}
+}
+
+static Fragment parse_repeat(Nfa *nfa) {
+	Fragment atom = parse_atom(nfa);
+	while (!nfa->error && (*nfa->input == '*' || *nfa->input == '+' ||
+						   *nfa->input == '?')) {
+		char op = *nfa->input++;
+		int split = add_node(nfa, NFA_SPLIT);
+		int end = add_node(nfa, NFA_EMPTY);
+		nfa->nodes[split].out = atom.start;
+		nfa->nodes[split].out2 = end;
+		// * and + loop back to the split, ? goes on
+		nfa->nodes[atom.end].out = op == '?' ? end : split;
+		atom = (Fragment){ op == '+' ? atom.start : split, end };
+	}
+	return atom;
+}
+
+static Fragment parse_concatenation(Nfa *nfa) {
+	Fragment result = empty_fragment(nfa);
+	while (!nfa->error && *nfa->input && *nfa->input != '|' &&
+		   *nfa->input != ')') {
+		Fragment next = parse_repeat(nfa);
+		nfa->nodes[result.end].out = next.start;
+		result.end = next.end;
+	}
+	return result;
+}
+
+static Fragment parse_alternation(Nfa *nfa) {
+	Fragment left = parse_concatenation(nfa);
+	while (!nfa->error && *nfa->input == '|') {
+		nfa->input++;
+		Fragment right = parse_concatenation(nfa);
+		int split = add_node(nfa, NFA_SPLIT);
+		int end = add_node(nfa, NFA_EMPTY);
+		nfa->nodes[split].out = left.start;
+		nfa->nodes[split].out2 = right.start;
+		nfa->nodes[left.end].out = end;
+		nfa->nodes[right.end].out = end;
+		left = (Fragment){ split, end };
+	}
+	return left;
+}
+
+typedef struct {
+	const Nfa *nfa;
+	size_t words; // uint64_t per node set
+	int start;
+	uint64_t *kept; // nodes that make up a DFA state
+	int *stack;
+	uint64_t *keys; // node set of every DFA state
+	uint32_t *table; // open addressing from node set to DFA state
+	size_t table_size;
+} Subsets;
+
+static bool has_node(const uint64_t *set, int node) {
+	return set[node >> 6] & (1ULL << (node & 63));
+}
+
+/**
+ * Adds to set every node reachable from the seeds on the stack without
+ * consuming a byte. ^ is passed at the start of a line, and $ only at its
+ * end, when computing what a following newline would match.
+ */
+static void closure(const Subsets *subsets, uint64_t *set, int depth,
+					bool line_start, bool line_end) {
+	const NfaNode *nodes = subsets->nfa->nodes;
+	while (depth > 0) {
+		int node = subsets->stack[--depth];
+		if (node < 0 || has_node(set, node))
+			continue;
+		set[node >> 6] |= 1ULL << (node & 63);
+		switch (nodes[node].type) {
+		case NFA_SPLIT:
+			subsets->stack[depth++] = nodes[node].out2;
+			// fall through
+		case NFA_EMPTY:
+			subsets->stack[depth++] = nodes[node].out;
+			break;
+		case NFA_LINE_START:
+			if (line_start)
+				subsets->stack[depth++] = nodes[node].out;
+			break;
+		case NFA_LINE_END:
+			if (line_end)
+				subsets->stack[depth++] = nodes[node].out;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static uint32_t first_match(const Subsets *subsets, const uint64_t *set) {
+	uint32_t pattern = NO_MATCH;
+	for (size_t node = 0; node < subsets->nfa->count; ++node) {
+		const NfaNode *n = &subsets->nfa->nodes[node];
+		if (n->type == NFA_MATCH && has_node(set, node) && n->pattern < pattern)
+			pattern = n->pattern;
+	}
+	return pattern;
+}
+
+static size_t hash_set(const uint64_t *set, size_t words) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < words; ++i)
+		hash = (hash ^ set[i]) * 1099511628211ULL;
+	return hash;
+}
+
+/**
+ * Finds or adds the DFA state of a node set. Only the nodes that matter
+ * after the closure, bytes, matches and $, tell states apart.
+ * @return The state, or NO_STATE if there would be too many.
+ */
+static uint32_t intern(Matcher *matcher, Subsets *subsets, uint64_t *set) {
+	size_t words = subsets->words;
+	for (size_t i = 0; i < words; ++i)
+		set[i] &= subsets->kept[i];
+
+	size_t slot = hash_set(set, words) & (subsets->table_size - 1);
+	for (; subsets->table[slot] != NO_STATE;
+		 slot = (slot + 1) & (subsets->table_size - 1)) {
+		uint32_t state = subsets->table[slot];
+		if (memcmp(subsets->keys + state * words, set,
+				   words * sizeof(uint64_t)) == 0)
+			return state;
+	}
+	if (matcher->state_count == MATCHER_MAX_STATES)
+		return NO_STATE;
+
+	uint32_t state = add_state(matcher);
+	subsets->keys = realloc(subsets->keys,
+							matcher->capacity * words * sizeof(uint64_t));
+	memcpy(subsets->keys + state * words, set, words * sizeof(uint64_t));
+	subsets->table[slot] = state;
+	return state;
+}
+
+/**
+ * Turns the NFA into a DFA by subset construction. The start of the NFA
+ * is added back after every byte, so the DFA finds matches anywhere.
+ * Bytes no NFA node tells apart share their target, which is computed
+ * once per group.
+ */
+static bool build_dfa(Matcher *matcher, const Nfa *nfa, int start,
+					  const char **error) {
+	size_t words = (nfa->count + 63) / 64;
+	Subsets subsets = {
+		.nfa = nfa,
+		.words = words,
+		.start = start,
+		.kept = calloc(words, sizeof(uint64_t)),
+		// seeds, then at most two pushes per node visited
+		.stack = malloc((nfa->count * 3 + 2) * sizeof(int)),
+		.table_size = MATCHER_MAX_STATES * 2,
+	};
+	subsets.table = malloc(subsets.table_size * sizeof(uint32_t));
+	memset(subsets.table, 0xff, subsets.table_size * sizeof(uint32_t));
+	for (size_t node = 0; node < nfa->count; ++node) {
+		NfaType type = nfa->nodes[node].type;
+		if (type == NFA_BYTES || type == NFA_MATCH || type == NFA_LINE_END)
+			subsets.kept[node >> 6] |= 1ULL << (node & 63);
+	}
+
+	// group the bytes by the NFA nodes that accept them
+	int byte_group[256], group_count = 0, representative[256];
+	for (int c = 0; c < 256; ++c) {
+		byte_group[c] = -1;
+		for (int group = 0; group < group_count && byte_group[c] < 0;
+			 ++group) {
+			int other = representative[group];
+			if ((c == '\n') != (other == '\n'))
+				continue;
+			bool same = true;
+			for (size_t node = 0; node < nfa->count && same; ++node) {
+				const NfaNode *n = &nfa->nodes[node];
+				if (n->type == NFA_BYTES)
+					same = has_node(n->bytes, c) == has_node(n->bytes, other);
+			}
+			if (same)
+				byte_group[c] = group;
+		}
+		if (byte_group[c] < 0) {
+			representative[group_count] = c;
+			byte_group[c] = group_count++;
+		}
+	}
+
+	uint64_t *set = malloc(words * sizeof(uint64_t));
+	memset(set, 0, words * sizeof(uint64_t));
+	subsets.stack[0] = start;
+	closure(&subsets, set, 1, true, false);
+	intern(matcher, &subsets, set);
+
+	bool ok = true;
+	uint32_t targets[256];
+	for (uint32_t state = 0; ok && state < matcher->state_count; ++state) {
+		const uint64_t *key = subsets.keys + state * words;
+		matcher->accept[state] = first_match(&subsets, key);
+
+		// what a newline right here would match through $
+		memset(set, 0, words * sizeof(uint64_t));
+		int depth = 0;
+		for (size_t node = 0; node < nfa->count; ++node) {
+			if (nfa->nodes[node].type == NFA_LINE_END && has_node(key, node))
+				subsets.stack[depth++] = node;
+		}
+		closure(&subsets, set, depth, false, true);
+		matcher->eol_accept[state] = first_match(&subsets, set);
+
+		for (int group = 0; ok && group < group_count; ++group) {
+			int c = representative[group];
+			key = subsets.keys + state * words; // intern may move keys
+			memset(set, 0, words * sizeof(uint64_t));
+			depth = 0;
+			for (size_t node = 0; node < nfa->count; ++node) {
+				const NfaNode *n = &nfa->nodes[node];
+				if (n->type == NFA_BYTES && has_node(key, node) &&
+					has_node(n->bytes, c))
+					subsets.stack[depth++] = n->out;
+			}
+			subsets.stack[depth++] = start;
+			closure(&subsets, set, depth, c == '\n', false);
+			targets[group] = intern(matcher, &subsets, set);
+			ok = targets[group] != NO_STATE;
+		}
+		for (int c = 0; ok && c < 256; ++c)
+			matcher->next[state * 256 + c] = targets[byte_group[c]];
+	}
+	if (!ok)
+		*error = "regular expression too complex";
+
+	free(set);
+	free(subsets.kept);
+	free(subsets.stack);
+	free(subsets.keys);
+	free(subsets.table);
+	return ok;
+}
+
+static bool build_regex(Matcher *matcher, const char *const *patterns,
+						size_t count, const char **error) {
+	Nfa nfa = { 0 };
+	int start = -1;
+	for (size_t i = 0; i < count && !nfa.error; ++i) {
+		nfa.input = patterns[i];
+		Fragment fragment = parse_alternation(&nfa);
+		if (!nfa.error && *nfa.input == ')')
+			nfa.error = "unmatched )";
+		int match = add_node(&nfa, NFA_MATCH);
+		nfa.nodes[match].pattern = i;
+		nfa.nodes[fragment.end].out = match;
+
+		// every pattern is an alternative of one NFA
+		if (start < 0) {
+			start = fragment.start;
+		} else {
+			int split = add_node(&nfa, NFA_SPLIT);
+			nfa.nodes[split].out = start;
+			nfa.nodes[split].out2 = fragment.start;
+			start = split;
+		}
+	}
+
+	bool ok = !nfa.error;
+	if (ok)
+		ok = build_dfa(matcher, &nfa, start, error);
+	else
+		*error = nfa.error;
+	free(nfa.nodes);
+	return ok;
+}
+
+/**
+ * Rewrites the transitions for the scan loop. A state that matches when
+ * a newline follows gets a newline transition to a state that reports
+ * that match, so the loop only tests one bit per byte.
+ */
+static void finish(Matcher *matcher) {
+	size_t states = matcher->state_count;
+	for (size_t state = 0; state < states; ++state) {
+		uint32_t pattern = matcher->eol_accept[state];
+		if (pattern == NO_MATCH)
+			continue;
+		// one such state per pattern is enough
+		uint32_t target = NO_STATE;
+		for (size_t other = states; other < matcher->state_count; ++other) {
+			if (matcher->accept[other] == pattern)
+				target = other;
+		}
+		if (target == NO_STATE) {
+			target = add_state(matcher);
+			matcher->accept[target] = pattern;
+			matcher->at_newline[target] = true;
+			// never left, the scan stops on entering it
+			for (int c = 0; c < 256; ++c)
+				matcher->next[target * 256 + c] = 0;
+		}
+		matcher->next[state * 256 + '\n'] = target;
+	}
+
+	for (int c = 0; c < 256; ++c)
+		matcher->stays_at_start[c] = matcher->next[c] == 0;
+
+	for (size_t i = 0; i < matcher->state_count * 256; ++i) {
+		uint32_t target = matcher->next[i];
+		matcher->next[i] = target * 256 |
+						   (matcher->accept[target] != NO_MATCH ? ACCEPTING : 0);
+	}
+}
+
+static bool same_patterns(const Matcher *matcher, const char *const *patterns,
+						  size_t count, bool regex) {
+	if (!matcher || matcher->count != count || matcher->regex != regex)
+		return false;
+	for (size_t i = 0; i < count; ++i) {
+		if (strcmp(matcher->patterns[i], patterns[i]) != 0)
+			return false;
+	}
+	return true;
+}
+
+const Matcher *matcher_compile(const char *const *patterns, size_t count,
+							   bool regex, const char **error) {
+	if (same_patterns(cached, patterns, count, regex))
+		return cached;
+
+	Matcher *matcher = calloc(1, sizeof(Matcher));
+	bool ok = regex ? build_regex(matcher, patterns, count, error)
+					: build_aho_corasick(matcher, patterns, count, error);
+	if (!ok) {
+		free_matcher(matcher);
+		return NULL;
+	}
+	finish(matcher);
+
+	matcher->patterns = malloc(count * sizeof(char *));
+	for (size_t i = 0; i < count; ++i)
+		matcher->patterns[i] = strdup(patterns[i]);
+	matcher->count = count;
+	matcher->regex = regex;
+	free_matcher(cached);
+	cached = matcher;
+	return matcher;
+}
+
+const char *matcher_find(const Matcher *matcher, const char *text,
+						 size_t len, size_t *pattern) {
+	if (len == 0)
+		return NULL;
+	if (matcher->accept[0] != NO_MATCH) {
+		*pattern = matcher->accept[0];
+		return text;
+	}
+
+	const uint32_t *next = matcher->next;
+	uint32_t offset = 0; // current state * 256
+	for (size_t i = 0; i < len; ++i) {
+		// in the start state, skip the bytes that stay there without
+		// waiting for each transition
+		if (offset == 0) {
+			while (i < len && matcher->stays_at_start[(unsigned char)text[i]])
+				i++;
+			if (i == len)
+				break;
+		}
+		uint32_t target = next[offset + (unsigned char)text[i]];
+		if (target & ACCEPTING) {
+			uint32_t state = (target & ~ACCEPTING) / 256;
+			*pattern = matcher->accept[state];
+			// a match that ends with a newline is an empty one on the
+			// next line, unless $ matched before the newline
+			if (text[i] != '\n' || matcher->at_newline[state])
+				return text + i;
+			return i + 1 < len ? text + i + 1 : NULL;
+		}
+		offset = target;
+	}
+
+	// $ also matches at the end of a last line without a newline
+	uint32_t state = offset / 256;
+	if (text[len - 1] != '\n' && matcher->eol_accept[state] != NO_MATCH) {
+		*pattern = matcher->eol_accept[state];
+		return text + len - 1;
+	}
+	return NULL;
+}
@@ -0,0 +1,34 @@
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct Matcher Matcher;
+
+/**
+ * Compiles a list of patterns into one DFA that scans a text once for all
+ * of them. Literal patterns build an Aho-Corasick automaton. Regular
+ * expressions support . [] [^] * + ? | () ^ $ and the escapes \d \w \s,
+ * are compiled to an NFA and turned into a DFA by subset construction.
+ * Matches never span a newline. The last compiled matcher is cached, so
+ * repeating a search does not compile it again.
+ * @param patterns Patterns, their index identifies them in matches.
+ * @param count Number of patterns.
+ * @param regex Whether the patterns are regular expressions.
+ * @param error Receives a message if compilation fails.
+ * @return The matcher, owned by the cache, or NULL on error.
+ */
+const Matcher *matcher_compile(const char *const *patterns, size_t count,
+							   bool regex, const char **error);
+
+/**
+ * Scans a text for the match that ends first. The DFA is immutable, so
+ * one matcher can be used by several threads at once.
+ * @param pattern Receives the index of the pattern that matched.
+ * @return A position inside the line that matched, or NULL.
+ */
+const char *matcher_find(const Matcher *matcher, const char *text,
+						 size_t len, size_t *pattern);
+
+#endif // MATCHER_H
@@ -0,0 +1,480 @@
+#define _GNU_SOURCE
+#include "parallel.h"
+#include "builtins.h"
+#include "pathcache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Exit status of a command that could not be started, as in pipelines
+#define PARALLEL_EXEC_FAILED 127
+
+// Bytes read from a command's stdout at a time
+#define PARALLEL_READ_SIZE (64 << 10)
+
+extern char **environ;
+
+// signals the commands must see as default, ^Z is left ignored because
+// the shell cannot take a builtin's children over as a job
+static const int job_signals[] = { SIGINT, SIGQUIT, SIGTTIN, SIGTTOU };
+
+// stdout of one command, kept until the ones before it are printed
+typedef struct {
+	char *data;
+	size_t length;
+	size_t capacity;
+	bool done;
+} Output;
+
+typedef struct {
+	pid_t pid; // 0 for a free slot
+	size_t input; // Index of the input it runs
+	int out_fd; // Read end of its stdout, -1 if not kept or at EOF
+} Slot;
+
+typedef struct {
+	const ParallelOptions *options;
+	int jobs;
+	const char *path; // NULL for a builtin
+	const Builtin *builtin;
+	int word_count; // Words of the template
+	bool has_placeholder; // A word holds "{}"
+	char **args; // Words of the next command, NULL terminated
+	char *scratch; // Words with "{}" replaced
+	size_t scratch_size;
+	pid_t leader; // Holds the process group, 0 without a terminal
+	pid_t group; // Process group of the commands, 0 for the caller's
+	int terminal; // fd of the terminal given to the group, or -1
+	Slot *slots;
+	int running;
+	struct pollfd *polls; // With keep_order, the stdout of each command
+	int *poll_slots; // Slot of each of those
+	Output *outputs; // One per input with keep_order
+	size_t next_output; // First input whose output is not printed yet
+	size_t failed;
+	bool interrupted;
+} Parallel;
+
+/**
+ * Moves the foreground process group of a terminal, see give_terminal.
+ */
+static void set_terminal(int fd, pid_t pgid) {
+	sigset_t set, old_set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGTTOU);
+	sigprocmask(SIG_BLOCK, &set, &old_set);
+	tcsetpgrp(fd, pgid);
+	sigprocmask(SIG_SETMASK, &old_set, NULL);
+}
+
+/**
+ * Finds a standard fd on the terminal, if this process is in its
+ * foreground group.
+ * @return The fd, or -1.
+ */
+static int foreground_terminal() {
+	for (int fd = STDIN_FILENO; fd <= STDERR_FILENO; ++fd)
+		if (isatty(fd) && tcgetpgrp(fd) == getpgrp())
+			return fd;
+	return -1;
+}
+
+/**
+ * Forks a process that only waits to be killed, so that the process
+ * group of the commands outlives every one of them and keeps the
+ * terminal from the first command to the last.
+ * @return pid of the leader, or -1 if fork failed.
+ */
+static pid_t start_leader() {
+	pid_t pid = fork();
+	if (pid == 0) {
+		setpgid(0, 0);
+		for (size_t i = 0; i < sizeof(job_signals) / sizeof(int); ++i)
+			signal(job_signals[i], SIG_DFL);
+		sigset_t mask;
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+		for (;;)
+			pause();
+	}
+	if (pid > 0)
+		setpgid(pid, pid);
+	return pid;
+}
+
+/**
+ * Fills p->args with the template's words for one input. Only the words
+ * holding "{}" are copied, into one scratch buffer.
+ */
+static void build_args(Parallel *p, const char *input) {
+	char **words = p->options->command->args;
+	if (!p->has_placeholder) {
+		p->args[p->word_count] = (char *)input;
+		return;
+	}
+
+	size_t input_len = strlen(input), size = 0;
+	for (int i = 0; i < p->word_count; ++i) {
+		if (!strstr(words[i], "{}"))
+			continue;
+		size += strlen(words[i]) + 1;
+		for (const char *c = words[i]; (c = strstr(c, "{}")); c += 2)
+			size += input_len;
+	}
+	if (size > p->scratch_size) {
+		p->scratch_size = size * 2;
+		p->scratch = realloc(p->scratch, p->scratch_size);
+	}
+
+	char *end = p->scratch;
+	for (int i = 0; i < p->word_count; ++i) {
+		if (!strstr(words[i], "{}"))
+			continue;
+		p->args[i] = end;
+		const char *c = words[i], *next;
+		while ((next = strstr(c, "{}"))) {
+			end = mempcpy(end, c, next - c);
+			end = mempcpy(end, input, input_len);
+			c = next + 2;
+		}
+		end = stpcpy(end, c) + 1;
+	}
+}
+
+/**
+ * Runs in the forked child of a builtin command and never returns.
+ */
+static void run_builtin_job(Parallel *p, int out_fd) {
+	if (p->group)
+		setpgid(0, p->group);
+	for (size_t i = 0; i < sizeof(job_signals) / sizeof(int); ++i)
+		signal(job_signals[i], SIG_DFL);
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+
+	if (out_fd != -1)
+		dup2(out_fd, STDOUT_FILENO);
+	if (p->options->inputs_from_stdin) {
+		int null_fd = open("/dev/null", O_RDONLY);
+		dup2(null_fd, STDIN_FILENO);
+		close(null_fd);
+	}
+
+	struct command_t command = *p->options->command;
+	command.name = p->args[0];
+	command.args = p->args;
+	command.arg_count = p->word_count + !p->has_placeholder + 1;
+	int code = p->builtin->handler(&command);
+	fflush(stdout);
+	_exit(code == UNKNOWN ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/**
+ * Starts the command of one input with posix_spawn, or fork for builtins.
+ * @return pid of the command, or -1 with errno set.
+ */
+static pid_t spawn_job(Parallel *p, int out_fd) {
+	if (p->builtin) {
+		pid_t pid = fork();
+		if (pid == 0)
+			run_builtin_job(p, out_fd);
+		return pid;
+	}
+
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t defaults, mask;
+
+	posix_spawn_file_actions_init(&actions);
+	if (out_fd != -1)
+		posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+	if (p->options->inputs_from_stdin)
+		posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null",
+										 O_RDONLY, 0);
+
+	sigemptyset(&defaults);
+	for (size_t i = 0; i < sizeof(job_signals) / sizeof(int); ++i)
+		sigaddset(&defaults, job_signals[i]);
+	sigemptyset(&mask);
+
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF |
+										POSIX_SPAWN_SETSIGMASK |
+										(p->group ? POSIX_SPAWN_SETPGROUP : 0));
+	posix_spawnattr_setpgroup(&attr, p->group);
+	posix_spawnattr_setsigdefault(&attr, &defaults);
+	posix_spawnattr_setsigmask(&attr, &mask);
+
+	pid_t pid;
+	int error = posix_spawn(&pid, p->path, &actions, &attr, p->args, environ);
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	errno = error;
+	return error ? -1 : pid;
+}
+
+static int write_all(int fd, const char *data, size_t length) {
+	while (length > 0) {
+		ssize_t written = write(fd, data, length);
+		if (written == -1 && errno == EINTR)
+			continue;
+		if (written == -1)
+			return -1;
+		data += written;
+		length -= written;
+	}
+	return 0;
+}
+
+/**
+ * Prints the kept outputs that are next in input order.
+ */
+static void flush_outputs(Parallel *p) {
+	while (p->next_output < p->options->input_count &&
+		   p->outputs[p->next_output].done) {
+		Output *output = &p->outputs[p->next_output++];
+		write_all(STDOUT_FILENO, output->data, output->length);
+		free(output->data);
+		output->data = NULL;
+	}
+}
+
+/**
+ * Records the end of one input's command.
+ */
+static void finish_job(Parallel *p, size_t input, int status) {
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		p->failed++;
+	// ^C reaches every command, start no more of them
+	if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT)
+		p->interrupted = true;
+	if (p->outputs) {
+		p->outputs[input].done = true;
+		flush_outputs(p);
+	}
+}
+
+/**
+ * Starts the command of one input in a free slot.
+ */
+static void start_job(Parallel *p, size_t input) {
+	int fds[2] = { -1, -1 };
+	if (p->outputs && pipe2(fds, O_CLOEXEC) == -1) {
+		perror("pipe2");
+		finish_job(p, input, PARALLEL_EXEC_FAILED << 8);
+		return;
+	}
+
+	build_args(p, p->options->inputs[input]);
+	pid_t pid = spawn_job(p, fds[1]);
+	if (fds[1] != -1)
+		close(fds[1]);
+	if (pid == -1) {
+		fprintf(stderr, "-%s: parallel: %s: %s\n", sysname, p->args[0],
+				strerror(errno));
+		if (fds[0] != -1)
+			close(fds[0]);
+		finish_job(p, input, PARALLEL_EXEC_FAILED << 8);
+		return;
+	}
+	// set the group from both sides so neither process races the other
+	if (p->group)
+		setpgid(pid, p->group);
+
+	Slot *slot = p->slots;
+	while (slot->pid)
+		slot++;
+	*slot = (Slot){ pid, input, fds[0] };
+	p->running++;
+}
+
+/**
+ * Waits for any command to finish and frees its slot.
+ */
+static void wait_any(Parallel *p) {
+	int status;
+	pid_t pid = waitpid(-p->group, &status, 0);
+	if (pid == -1) {
+		if (errno != EINTR) {
+			perror("waitpid");
+			p->running = 0; // no children left to wait for
+		}
+		return;
+	}
+	if (pid == p->leader) {
+		// killed along with the commands, no new one can join the group
+		p->leader = 0;
+		p->interrupted = true;
+		return;
+	}
+	for (int i = 0; i < p->jobs; ++i) {
+		if (p->slots[i].pid == pid) {
+			p->slots[i].pid = 0;
+			p->running--;
+			finish_job(p, p->slots[i].input, status);
+			return;
+		}
+	}
+}
+
+/**
+ * Reads the stdout of the running commands until one of them reaches
+ * EOF, then waits for that command and frees its slot.
+ */
+static void read_outputs(Parallel *p) {
+	int count = 0;
+	for (int i = 0; i < p->jobs; ++i) {
+		if (p->slots[i].pid && p->slots[i].out_fd != -1) {
+			p->polls[count] = (struct pollfd){ p->slots[i].out_fd, POLLIN, 0 };
+			p->poll_slots[count++] = i;
+		}
+	}
+	if (poll(p->polls, count, -1) == -1)
+		return; // EINTR, poll again
+
+	for (int i = 0; i < count; ++i) {
+		if (!p->polls[i].revents)
+			continue;
+		Slot *slot = &p->slots[p->poll_slots[i]];
+		Output *output = &p->outputs[slot->input];
+		if (output->capacity - output->length < PARALLEL_READ_SIZE) {
+			output->capacity = output->capacity * 2 + PARALLEL_READ_SIZE;
+			output->data = realloc(output->data, output->capacity);
+		}
+		ssize_t got = read(slot->out_fd, output->data + output->length,
+						   output->capacity - output->length);
+		if (got > 0) {
+			output->length += got;
+			continue;
+		}
+		if (got == -1 && errno == EINTR)
+			continue;
+
+		close(slot->out_fd);
+		slot->out_fd = -1;
+		int status;
+		while (waitpid(slot->pid, &status, 0) == -1 && errno == EINTR)
+			;
+		slot->pid = 0;
+		p->running--;
+		finish_job(p, slot->input, status);
+	}
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int run_parallel(const ParallelOptions *options) {
+	const struct command_t *command = options->command;
+	Parallel p = { .options = options, .jobs = options->jobs, .terminal = -1 };
+	if (p.jobs <= 0)
+		p.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (p.jobs <= 0)
+		p.jobs = 1;
+
+	// the template is resolved once for every input
+	char *path = NULL;
+	p.builtin = find_builtin(command->name);
+	if (!p.builtin) {
+		const char *found = pathcache_lookup(command->name);
+		if (!found) {
+			fprintf(stderr, "-%s: %s: command not found\n", sysname,
+					command->name);
+			return -1;
+		}
+		p.path = path = strdup(found);
+	}
+
+	p.word_count = command->arg_count - 1;
+	for (int i = 0; i < p.word_count; ++i)
+		if (strstr(command->args[i], "{}"))
+			p.has_placeholder = true;
+	p.args = calloc(p.word_count + 2, sizeof(char *));
+	memcpy(p.args, command->args, p.word_count * sizeof(char *));
+	p.slots = calloc(p.jobs, sizeof(Slot));
+	if (options->keep_order) {
+		p.outputs = calloc(options->input_count ? options->input_count : 1,
+						   sizeof(Output));
+		p.polls = calloc(p.jobs, sizeof(struct pollfd));
+		p.poll_slots = calloc(p.jobs, sizeof(int));
+	}
+
+	// buffered output must not be duplicated into forked builtins
+	fflush(NULL);
+
+	struct sigaction ignore = { .sa_handler = SIG_IGN }, old_tstp;
+	p.terminal = foreground_terminal();
+	if (p.terminal != -1) {
+		p.leader = p.group = start_leader();
+		if (p.leader > 0) {
+			sigaction(SIGTSTP, &ignore, &old_tstp);
+			set_terminal(p.terminal, p.leader);
+		} else {
+			p.leader = p.group = 0;
+			p.terminal = -1;
+		}
+	}
+
+	double start = now();
+	size_t next_input = 0;
+	for (;;) {
+		while (!p.interrupted && p.running < p.jobs &&
+			   next_input < options->input_count)
+			start_job(&p, next_input++);
+		if (p.running == 0)
+			break;
+		if (p.outputs)
+			read_outputs(&p);
+		else
+			wait_any(&p);
+	}
+	double elapsed = now() - start;
+
+	if (p.terminal != -1) {
+		set_terminal(p.terminal, getpgrp());
+		sigaction(SIGTSTP, &old_tstp, NULL);
+	}
+	if (p.leader) {
+		kill(p.leader, SIGKILL);
+		while (waitpid(p.leader, NULL, 0) == -1 && errno == EINTR)
+			;
+	}
+
+	fprintf(stderr,
+			"parallel: %zu of %zu commands in %.3f s, %.1f commands/s, "
+			"%zu failed%s\n",
+			next_input, options->input_count, elapsed,
+			elapsed > 0 ? next_input / elapsed : 0.0, p.failed,
+			p.interrupted ? ", interrupted" : "");
+
+	if (p.outputs) {
+		// after ^C the commands that were never started leave gaps
+		for (size_t i = p.next_output; i < options->input_count; ++i) {
+			if (p.outputs[i].done)
+				write_all(STDOUT_FILENO, p.outputs[i].data,
+						  p.outputs[i].length);
+			free(p.outputs[i].data);
+		}
+		free(p.outputs);
+		free(p.polls);
+		free(p.poll_slots);
+	}
+	free(p.slots);
+	free(p.args);
+	free(p.scratch);
+	free(path);
+	return p.failed;
+}
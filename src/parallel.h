@@ -0,0 +1,31 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "shell.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+	const struct command_t *command; // Template run once per input
+	char **inputs; // Replace each "{}" in the template, or are appended
+	size_t input_count;
+	int jobs; // Commands running at once, 0 for one per online CPU
+	bool keep_order; // Buffer each command's stdout and print it in input order
+	bool inputs_from_stdin; // Commands get /dev/null as stdin, not the inputs
+} ParallelOptions;
+
+/**
+ * Runs the template command once per input with at most options->jobs
+ * commands at a time, starting the next one as soon as one finishes.
+ * The template's path is looked up once and only the words holding "{}"
+ * are rebuilt for each input. The commands share a process group that
+ * gets the terminal when the shell has it, so ^C stops them all and no
+ * further commands are started. Prints the wall time and the throughput
+ * to stderr at the end.
+ * @param options ParallelOptions with the template and the inputs.
+ * @return The number of commands that failed, or -1 if the command was
+ * not found.
+ */
+int run_parallel(const ParallelOptions *options);
+
+#endif // PARALLEL_H
@@ -0,0 +1,333 @@
+#include "parser.h"
+#include "arena.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Prints a command struct
+ * @param struct command_t *
+ */
+void print_command(struct command_t *command) {
+	int i = 0;
+	printf("Command: <%s>\n", command->name);
+	printf("\tIs Background: %s\n", command->background ? "yes" : "no");
+	printf("\tRedirects:\n");
+
+	for (i = 0; i < 3; i++) {
+		printf("\t\t%d: %s\n", i,
+			   command->redirects[i] ? command->redirects[i] : "N/A");
+	}
+
+	printf("\tArguments (%d):\n", command->arg_count);
+
+	for (i = 0; i < command->arg_count; ++i) {
+		printf("\t\tArg %d: %s\n", i, command->args[i]);
+	}
+
+	if (command->next) {
+		printf("\tPiped to:\n");
+		print_command(command->next);
+	}
+
+	if (command->list_next) {
+		const char *ops[] = { ";", "&&", "||" };
+		printf("\tThen (%s):\n", ops[command->list_op]);
+		print_command(command->list_next);
+	}
+}
+
+int free_command(struct command_t *command) {
+	// piped stages and every string live in the arena of the first stage
+	if (command->arena)
+		arena_destroy(command->arena);
+	free(command);
+	return 0;
+}
+
+// initial number of argument slots, doubled whenever they run out
+#define PARSER_MIN_ARGS 8
+
+typedef enum {
+	TOKEN_WORD,
+	TOKEN_PIPE, // |
+	TOKEN_BACKGROUND, // &
+	TOKEN_IN, // <
+	TOKEN_OUT, // >
+	TOKEN_APPEND, // >>
+	TOKEN_SEMICOLON, // ;
+	TOKEN_AND, // &&
+	TOKEN_OR, // ||
+	TOKEN_END,
+	TOKEN_ERROR, // unterminated quote
+} TokenType;
+
+typedef struct {
+	const char *in; // next input character
+	const char *end; // end of the input
+	char *out; // where the next word is written, inside the arena
+} Lexer;
+
+static bool is_blank(char c) {
+	return c == ' ' || c == '\t';
+}
+
+static bool is_operator(char c) {
+	return c == '|' || c == '&' || c == '<' || c == '>' || c == ';';
+}
+
+/**
+ * Reads the next token. Words are unquoted and unescaped straight into the
+ * arena as they are scanned, so every input byte is looked at once.
+ * @param word Set to the word for TOKEN_WORD
+ */
+static TokenType next_token(Lexer *lexer, char **word) {
+	const char *in = lexer->in, *end = lexer->end;
+
+	while (in < end && is_blank(*in))
+		in++;
+
+	// a comment runs to the end of the line
+	if (in == end || *in == '#') {
+		lexer->in = end;
+		return TOKEN_END;
+	}
+
+	if (is_operator(*in)) {
+		TokenType type = TOKEN_PIPE;
+		switch (*in++) {
+		case '|':
+			if (in < end && *in == '|') {
+				type = TOKEN_OR;
+				in++;
+			}
+			break;
+		case '&':
+			type = TOKEN_BACKGROUND;
+			if (in < end && *in == '&') {
+				type = TOKEN_AND;
+				in++;
+			}
+			break;
+		case ';':
+			type = TOKEN_SEMICOLON;
+			break;
+		case '<':
+			type = TOKEN_IN;
+			break;
+		case '>':
+			type = TOKEN_OUT;
+			if (in < end && *in == '>') {
+				type = TOKEN_APPEND;
+				in++;
+			}
+			break;
+		}
+		lexer->in = in;
+		return type;
+	}
+
+	char *out = lexer->out;
+	*word = out;
+	while (in < end && !is_blank(*in) && !is_operator(*in)) {
+		char c = *in++;
+
+		if (c == '\\') {
+			// a trailing backslash stays as it is
+			*out++ = in < end ? *in++ : c;
+		} else if (c == '\'') {
+			// everything up to the closing quote is literal
+			while (in < end && *in != '\'')
+				*out++ = *in++;
+			if (in++ == end)
+				return TOKEN_ERROR;
+		} else if (c == '"') {
+			while (in < end && *in != '"') {
+				// only these keep their meaning after a backslash
+				if (*in == '\\' && in + 1 < end &&
+					strchr("\"\\$`", in[1]) != NULL)
+					in++;
+				*out++ = *in++;
+			}
+			if (in++ == end)
+				return TOKEN_ERROR;
+		} else {
+			*out++ = c;
+		}
+	}
+	*out++ = 0;
+
+	lexer->in = in;
+	lexer->out = out;
+	return TOKEN_WORD;
+}
+
+static const char *token_text(TokenType type, const char *word) {
+	switch (type) {
+	case TOKEN_WORD:
+		return word;
+	case TOKEN_PIPE:
+		return "|";
+	case TOKEN_BACKGROUND:
+		return "&";
+	case TOKEN_IN:
+		return "<";
+	case TOKEN_OUT:
+		return ">";
+	case TOKEN_APPEND:
+		return ">>";
+	case TOKEN_SEMICOLON:
+		return ";";
+	case TOKEN_AND:
+		return "&&";
+	case TOKEN_OR:
+		return "||";
+	default:
+		return "newline";
+	}
+}
+
+/**
+ * Appends a word to the arguments of a stage, growing args inside the
+ * arena. args[0] is the name, and a slot is always kept for the NULL.
+ */
+static void add_arg(Arena *arena, struct command_t *stage, int *capacity,
+					char *word) {
+	if (stage->arg_count + 1 >= *capacity) {
+		char **args = arena_alloc(arena, sizeof(char *) * *capacity * 2);
+		memcpy(args, stage->args, sizeof(char *) * *capacity);
+		stage->args = args;
+		*capacity *= 2;
+	}
+	stage->args[stage->arg_count++] = word;
+}
+
+/**
+ * Ends a stage: an empty one gets an empty name, and args[arg_count-1]
+ * (last) is set to NULL.
+ */
+static void finish_stage(Arena *arena, struct command_t *stage,
+						 int *capacity) {
+	if (!stage->name) {
+		stage->name = arena_strdup(arena, "");
+		add_arg(arena, stage, capacity, stage->name);
+	}
+	stage->args[stage->arg_count++] = NULL;
+}
+
+/**
+ * Reports a syntax error and leaves an empty command behind, so nothing
+ * of the line runs.
+ * @return -1
+ */
+static int syntax_error(struct command_t *command, TokenType type,
+						const char *word) {
+	if (type == TOKEN_ERROR) {
+		fprintf(stderr, "-%s: syntax error: unterminated quote\n", sysname);
+	} else {
+		fprintf(stderr, "-%s: syntax error near unexpected token `%s'\n",
+				sysname, token_text(type, word));
+	}
+
+	Arena *arena = command->arena;
+	int capacity = 2;
+	memset(command, 0, sizeof(*command));
+	command->arena = arena;
+	command->args = arena_alloc(arena, sizeof(char *) * capacity);
+	finish_stage(arena, command, &capacity);
+	return -1;
+}
+
+int parse_command(char *buf, struct command_t *command) {
+	if (!command->arena)
+		command->arena = arena_create();
+	Arena *arena = command->arena;
+
+	size_t len = strlen(buf);
+	while (len > 0 && is_blank(buf[len - 1]))
+		len--; // trim right whitespace
+
+	// unquoted words are never longer than their input, so one block of
+	// the line's size holds all of them
+	Lexer lexer = { buf, buf + len, arena_alloc(arena, len + 1) };
+	// stage is the one being filled, head the first stage of its pipeline
+	struct command_t *stage = command, *head = command, *previous = NULL;
+	int capacity = PARSER_MIN_ARGS;
+	stage->args = arena_alloc(arena, sizeof(char *) * capacity);
+
+	TokenType type, target;
+	char *word = NULL;
+	while ((type = next_token(&lexer, &word)) != TOKEN_END) {
+		switch (type) {
+		case TOKEN_WORD:
+			if (!stage->name)
+				stage->name = word;
+			add_arg(arena, stage, &capacity, word);
+			continue;
+
+		case TOKEN_IN:
+		case TOKEN_OUT:
+		case TOKEN_APPEND:
+			target = next_token(&lexer, &word);
+			if (target != TOKEN_WORD) {
+				type = target;
+				break;
+			}
+			stage->redirects[type - TOKEN_IN] = word;
+			continue;
+
+		case TOKEN_PIPE:
+			// piping to another command
+			if (!stage->name)
+				break;
+			finish_stage(arena, stage, &capacity);
+			stage->next = arena_calloc(arena, sizeof(struct command_t));
+			stage = stage->next;
+			stage->arena = arena;
+			capacity = PARSER_MIN_ARGS;
+			stage->args = arena_alloc(arena, sizeof(char *) * capacity);
+			continue;
+
+		case TOKEN_BACKGROUND:
+		case TOKEN_SEMICOLON:
+		case TOKEN_AND:
+		case TOKEN_OR:
+			// the pipeline ends, another one may follow in the list
+			if (!stage->name)
+				break;
+			if (type == TOKEN_BACKGROUND)
+				head->background = true;
+			finish_stage(arena, stage, &capacity);
+			head->list_op = type == TOKEN_AND  ? LIST_AND
+							: type == TOKEN_OR ? LIST_OR
+											   : LIST_ALWAYS;
+			head->list_next = arena_calloc(arena, sizeof(struct command_t));
+			previous = head;
+			stage = head = head->list_next;
+			stage->arena = arena;
+			capacity = PARSER_MIN_ARGS;
+			stage->args = arena_alloc(arena, sizeof(char *) * capacity);
+			continue;
+
+		default:
+			break;
+		}
+		return syntax_error(command, type, word);
+	}
+
+	// a pipe needs a command on its right
+	if (!stage->name && stage != head)
+		return syntax_error(command, TOKEN_END, NULL);
+
+	// a list may end with ; or &, but && and || need a command after them
+	if (!stage->name && previous) {
+		if (previous->list_op != LIST_ALWAYS)
+			return syntax_error(command, TOKEN_END, NULL);
+		previous->list_next = NULL;
+		return 0;
+	}
+
+	finish_stage(arena, stage, &capacity);
+	return 0;
+}
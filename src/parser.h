@@ -0,0 +1,29 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "shell.h"
+
+/**
+ * Parse a command string into a command struct. Every string and every
+ * piped stage is allocated from the arena of the command, which is
+ * created on the first call.
+ * @param  buf     Command line, modified in place
+ * @param  command Zeroed command struct
+ * @return         0
+ */
+int parse_command(char *buf, struct command_t *command);
+
+/**
+ * Release allocated memory of a command and all of its piped stages
+ * @param  command Command returned through parse_command
+ * @return         0
+ */
+int free_command(struct command_t *command);
+
+/**
+ * Prints a command struct
+ * @param struct command_t *
+ */
+void print_command(struct command_t *command);
+
+#endif // PARSER_H
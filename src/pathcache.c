@@ -0,0 +1,232 @@
+#include "pathcache.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// PATH directories are re-stat'ed at most this often
+#define PATHCACHE_RECHECK_NS 1000000000L
+
+#define PATHCACHE_MIN_CAPACITY 64
+
+typedef struct {
+	char *name;
+	char *path;
+	int dir_index; // Index of the PATH directory the command was found in
+	unsigned hits;
+} PathEntry;
+
+typedef struct {
+	char *path;
+	struct timespec mtime;
+} PathDir;
+
+static PathEntry *entries; // open addressing, linear probing
+static size_t capacity, count;
+
+static char *path_value; // PATH the directory list was built from
+static PathDir *dirs;
+static int dir_count;
+static struct timespec last_check;
+
+static unsigned long hash_name(const char *name) {
+	unsigned long hash = 14695981039346656037UL; // FNV-1a
+	while (*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+static PathEntry *find_slot(PathEntry *table, size_t size, const char *name) {
+	size_t i = hash_name(name) & (size - 1);
+	while (table[i].name && strcmp(table[i].name, name) != 0)
+		i = (i + 1) & (size - 1);
+	return &table[i];
+}
+
+static void insert_entry(PathEntry entry) {
+	if ((count + 1) * 4 > capacity * 3) {
+		size_t new_capacity = capacity ? capacity * 2 : PATHCACHE_MIN_CAPACITY;
+		PathEntry *table = calloc(new_capacity, sizeof(PathEntry));
+		for (size_t i = 0; i < capacity; ++i) {
+			if (entries[i].name)
+				*find_slot(table, new_capacity, entries[i].name) = entries[i];
+		}
+		free(entries);
+		entries = table;
+		capacity = new_capacity;
+	}
+	*find_slot(entries, capacity, entry.name) = entry;
+	count++;
+}
+
+/**
+ * Drops every entry found in PATH directory first_dir or a later one, and
+ * the entry for name if it is not NULL. The table is rebuilt rather than
+ * using tombstones so probe chains stay short.
+ */
+static void remove_entries(int first_dir, const char *name) {
+	PathEntry *old = entries;
+	size_t old_capacity = capacity;
+
+	entries = NULL;
+	capacity = count = 0;
+	for (size_t i = 0; i < old_capacity; ++i) {
+		if (!old[i].name)
+			continue;
+		if (old[i].dir_index < first_dir &&
+			(!name || strcmp(old[i].name, name) != 0)) {
+			insert_entry(old[i]);
+		} else {
+			free(old[i].name);
+			free(old[i].path);
+		}
+	}
+	free(old);
+}
+
+static void stat_dir(PathDir *dir) {
+	struct stat st;
+	if (stat(dir->path, &st) == 0) {
+		dir->mtime = st.st_mtim;
+	} else {
+		dir->mtime.tv_sec = dir->mtime.tv_nsec = 0;
+	}
+}
+
+static void load_path(const char *path) {
+	for (int i = 0; i < dir_count; ++i)
+		free(dirs[i].path);
+	free(dirs);
+	free(path_value);
+
+	path_value = strdup(path);
+	dir_count = 1;
+	for (const char *p = path; *p; ++p)
+		dir_count += *p == ':';
+	dirs = calloc(dir_count, sizeof(PathDir));
+
+	const char *start = path;
+	for (int i = 0; i < dir_count; ++i) {
+		const char *end = strchr(start, ':');
+		size_t len = end ? (size_t)(end - start) : strlen(start);
+		// an empty entry means the current directory
+		dirs[i].path = len ? strndup(start, len) : strdup(".");
+		stat_dir(&dirs[i]);
+		start += len + 1;
+	}
+}
+
+/**
+ * Brings the cache in line with the current PATH and its directories.
+ */
+static void validate() {
+	const char *path = getenv("PATH");
+	if (!path)
+		path = "/bin:/usr/bin"; // execvp's default
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (!path_value || strcmp(path, path_value) != 0) {
+		pathcache_flush();
+		load_path(path);
+		last_check = now;
+		return;
+	}
+
+	long elapsed = (now.tv_sec - last_check.tv_sec) * 1000000000L +
+				   (now.tv_nsec - last_check.tv_nsec);
+	if (elapsed < PATHCACHE_RECHECK_NS)
+		return;
+	last_check = now;
+
+	// a change in a directory can only shadow or remove commands found
+	// there or further down PATH
+	int first_changed = dir_count;
+	for (int i = 0; i < dir_count; ++i) {
+		struct timespec old = dirs[i].mtime;
+		stat_dir(&dirs[i]);
+		if (first_changed == dir_count &&
+			(old.tv_sec != dirs[i].mtime.tv_sec ||
+			 old.tv_nsec != dirs[i].mtime.tv_nsec))
+			first_changed = i;
+	}
+	if (first_changed < dir_count)
+		remove_entries(first_changed, NULL);
+}
+
+static int is_executable(const char *path) {
+	struct stat st;
+	return stat(path, &st) == 0 && S_ISREG(st.st_mode) &&
+		   access(path, X_OK) == 0;
+}
+
+const char *pathcache_lookup(const char *name) {
+	if (strchr(name, '/'))
+		return name;
+
+	validate();
+
+	if (capacity) {
+		PathEntry *entry = find_slot(entries, capacity, name);
+		if (entry->name) {
+			entry->hits++;
+			return entry->path;
+		}
+	}
+
+	char candidate[PATH_MAX];
+	for (int i = 0; i < dir_count; ++i) {
+		int len = snprintf(candidate, sizeof(candidate), "%s/%s",
+						   dirs[i].path, name);
+		if (len < 0 || len >= (int)sizeof(candidate))
+			continue;
+		if (!is_executable(candidate))
+			continue;
+
+		// relative directories change meaning with cd, never cache them
+		if (dirs[i].path[0] != '/') {
+			static char relative[PATH_MAX];
+			strcpy(relative, candidate);
+			return relative;
+		}
+
+		PathEntry entry = { strdup(name), strdup(candidate), i, 1 };
+		insert_entry(entry);
+		return entry.path;
+	}
+	return NULL;
+}
+
+void pathcache_forget(const char *name) {
+	if (capacity && find_slot(entries, capacity, name)->name)
+		remove_entries(INT_MAX, name);
+}
+
+void pathcache_flush() {
+	for (size_t i = 0; i < capacity; ++i) {
+		free(entries[i].name);
+		free(entries[i].path);
+	}
+	free(entries);
+	entries = NULL;
+	capacity = count = 0;
+}
+
+void pathcache_print() {
+	if (!count) {
+		printf("hash: hash table empty\n");
+		return;
+	}
+
+	printf("hits\tcommand\n");
+	for (size_t i = 0; i < capacity; ++i) {
+		if (entries[i].name)
+			printf("%4u\t%s\n", entries[i].hits, entries[i].path);
+	}
+}
@@ -0,0 +1,29 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+/**
+ * Resolves a command name to the executable execvp would run, through a
+ * hash table of earlier lookups. Entries are dropped when PATH changes or
+ * when the mtime of a PATH directory that could shadow them changes.
+ * @param name Command name. Names containing a '/' are returned as is.
+ * @return Path to exec, owned by the cache and valid until the next call
+ * into it, or NULL if the command is not found.
+ */
+const char *pathcache_lookup(const char *name);
+
+/**
+ * Drops the entry for name, e.g. after exec reported it no longer exists.
+ */
+void pathcache_forget(const char *name);
+
+/**
+ * Drops every entry ("hash -r").
+ */
+void pathcache_flush();
+
+/**
+ * Prints every entry with its hit count, in the format of bash's "hash".
+ */
+void pathcache_print();
+
+#endif // PATHCACHE_H
@@ -0,0 +1,459 @@
+#define _GNU_SOURCE
+#include "pipeline.h"
+#include "builtins.h"
+#include "pathcache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Pipes between stages are grown to this size so that large streams move
+// with fewer context switches. Clamped to /proc/sys/fs/pipe-max-size.
+#define PIPELINE_PIPE_SIZE (1 << 20)
+
+// Exit status reported for a stage that could not be executed
+#define PIPELINE_EXEC_FAILED 127
+
+// Runs executables without a "#!" line, as execvp does on ENOEXEC
+#define PIPELINE_SCRIPT_SHELL "/bin/sh"
+
+// glibc 2.35 lets a spawned child take the terminal itself, older versions
+// fall back to fork for the stage that has to
+#if defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 35)
+#define SPAWN_CAN_TAKE_TERMINAL
+#endif
+#endif
+
+extern char **environ;
+
+// signals the shell may ignore or handle that stages must see as default
+static const int stage_signals[] = { SIGINT, SIGQUIT, SIGTSTP, SIGTTIN,
+									 SIGTTOU };
+
+/**
+ * Returns the pipe buffer size to request with F_SETPIPE_SZ.
+ * Unprivileged processes cannot exceed pipe-max-size, so read it once.
+ */
+static int pipe_size() {
+	static int size = 0;
+	if (size)
+		return size;
+
+	size = PIPELINE_PIPE_SIZE;
+	FILE *file = fopen("/proc/sys/fs/pipe-max-size", "r");
+	if (file) {
+		int max_size;
+		if (fscanf(file, "%d", &max_size) == 1 && max_size > 0 &&
+			max_size < size)
+			size = max_size;
+		fclose(file);
+	}
+	return size;
+}
+
+/**
+ * Moves the terminal's foreground process group to pgid. SIGTTOU is blocked
+ * while doing so because the caller may itself be in a background group.
+ */
+void give_terminal(pid_t pgid) {
+	sigset_t set, old_set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGTTOU);
+	sigprocmask(SIG_BLOCK, &set, &old_set);
+	tcsetpgrp(STDIN_FILENO, pgid);
+	sigprocmask(SIG_SETMASK, &old_set, NULL);
+}
+
+int apply_redirects(const struct command_t *command) {
+	int fd;
+
+	// Operator >
+	if (command->redirects[1]) {
+		fd = open(command->redirects[1], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (fd < 0) {
+			fprintf(stderr, "Error while doing operator > \n");
+			return -1;
+		}
+		dup2(fd, STDOUT_FILENO);
+		close(fd);
+	}
+
+	// Operator >>
+	if (command->redirects[2]) {
+		fd = open(command->redirects[2], O_WRONLY | O_CREAT | O_APPEND, 0666);
+		if (fd < 0) {
+			fprintf(stderr, "Error while doing operator >> \n");
+			return -1;
+		}
+		dup2(fd, STDOUT_FILENO);
+		close(fd);
+	}
+
+	// Operator <
+	if (command->redirects[0]) {
+		fd = open(command->redirects[0], O_RDONLY);
+		if (fd < 0) {
+			fprintf(stderr, "Error while doing operator < \n");
+			return -1;
+		}
+		dup2(fd, STDIN_FILENO);
+		close(fd);
+	}
+
+	return 0;
+}
+
+/**
+ * Builds the arguments that run an executable without a "#!" line with
+ * PIPELINE_SCRIPT_SHELL: the shell, the path, then the stage's arguments.
+ * @return The NULL terminated arguments, to be freed.
+ */
+static char **script_args(const struct command_t *command, const char *path) {
+	// arg_count includes the NULL terminator, args[0] becomes the path
+	char **args = malloc((command->arg_count + 1) * sizeof(char *));
+	args[0] = PIPELINE_SCRIPT_SHELL;
+	args[1] = (char *)path;
+	memcpy(args + 2, command->args + 1,
+		   (command->arg_count - 1) * sizeof(char *));
+	return args;
+}
+
+/**
+ * Runs in the forked child of one stage and never returns.
+ * All pipe ends are O_CLOEXEC, so only the ones dup'ed onto stdin/stdout
+ * survive the exec.
+ * @param path Executable resolved by pathcache_lookup, NULL for builtins.
+ */
+static void exec_stage(struct command_t *command, const char *path,
+					   pid_t pgid, int in_fd, int out_fd, bool take_terminal) {
+	setpgid(0, pgid);
+	if (take_terminal)
+		give_terminal(getpgrp());
+
+	for (size_t i = 0; i < sizeof(stage_signals) / sizeof(int); ++i)
+		signal(stage_signals[i], SIG_DFL);
+	// the shell blocks SIGCHLD to read it from a signalfd
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+
+	if (in_fd != STDIN_FILENO)
+		dup2(in_fd, STDIN_FILENO);
+	if (out_fd != STDOUT_FILENO)
+		dup2(out_fd, STDOUT_FILENO);
+
+	// explicit redirects win over the pipe, as in other shells
+	if (apply_redirects(command) == -1)
+		_exit(EXIT_FAILURE);
+
+	// builtins in a pipeline or in the background run in the forked child
+	const Builtin *builtin = find_builtin(command->name);
+	if (builtin) {
+		int code = builtin->handler(command);
+		fflush(stdout);
+		_exit(code == UNKNOWN ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	execve(path, command->args, environ);
+	if (errno == ENOEXEC)
+		execve(PIPELINE_SCRIPT_SHELL, script_args(command, path), environ);
+	perror("execv"); // execv returns only if an error occurs
+	_exit(EXIT_FAILURE);
+}
+
+/**
+ * Forks a child for a stage that posix_spawn cannot express.
+ * @return pid of the stage, or -1 if fork failed.
+ */
+static pid_t fork_stage(struct command_t *command, const char *path,
+						pid_t pgid, int in_fd, int out_fd, bool take_terminal) {
+	pid_t pid = fork();
+	if (pid == -1)
+		perror("fork");
+	if (pid == 0)
+		exec_stage(command, path, pgid, in_fd, out_fd, take_terminal);
+	return pid;
+}
+
+/**
+ * Starts a stage with posix_spawn. glibc implements it with
+ * clone(CLONE_VM|CLONE_VFORK), so launch time does not grow with the
+ * shell's heap the way fork's page-table copy does. Pipe ends and the
+ * <, > and >> redirects become file actions, in the order exec_stage
+ * applies them.
+ * @param path Executable resolved by pathcache_lookup, NULL for builtins.
+ * @param error Set to the spawn error if the stage could not be started.
+ * @return pid of the stage, 0 if the stage needs fork, -1 on error.
+ */
+static pid_t spawn_stage(struct command_t *command, const char *path,
+						 pid_t pgid, int in_fd, int out_fd, bool take_terminal,
+						 int *error) {
+	// builtins have to run shell code in the child
+	if (!path)
+		return 0;
+#ifndef SPAWN_CAN_TAKE_TERMINAL
+	if (take_terminal)
+		return 0;
+#endif
+
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t defaults, mask;
+
+	posix_spawn_file_actions_init(&actions);
+	if (in_fd != STDIN_FILENO)
+		posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+	if (out_fd != STDOUT_FILENO)
+		posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+	if (command->redirects[1])
+		posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+										 command->redirects[1],
+										 O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (command->redirects[2])
+		posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+										 command->redirects[2],
+										 O_WRONLY | O_CREAT | O_APPEND, 0666);
+	if (command->redirects[0])
+		posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+										 command->redirects[0], O_RDONLY, 0);
+#ifdef SPAWN_CAN_TAKE_TERMINAL
+	if (take_terminal)
+		posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+#endif
+
+	sigemptyset(&defaults);
+	for (size_t i = 0; i < sizeof(stage_signals) / sizeof(int); ++i)
+		sigaddset(&defaults, stage_signals[i]);
+	sigemptyset(&mask);
+
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP |
+										POSIX_SPAWN_SETSIGDEF |
+										POSIX_SPAWN_SETSIGMASK);
+	posix_spawnattr_setpgroup(&attr, pgid);
+	posix_spawnattr_setsigdefault(&attr, &defaults);
+	posix_spawnattr_setsigmask(&attr, &mask);
+
+	pid_t pid;
+	*error = posix_spawn(&pid, path, &actions, &attr, command->args, environ);
+	if (*error == ENOENT && path != command->name &&
+		access(path, X_OK) != 0) {
+		// the cached binary went away rather than a redirect target, look
+		// it up again once
+		pathcache_forget(command->name);
+		path = pathcache_lookup(command->name);
+		if (path)
+			*error = posix_spawn(&pid, path, &actions, &attr, command->args,
+								 environ);
+	}
+	if (*error == ENOEXEC) {
+		char **args = script_args(command, path);
+		*error = posix_spawn(&pid, PIPELINE_SCRIPT_SHELL, &actions, &attr,
+							 args, environ);
+		free(args);
+	}
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	return *error ? -1 : pid;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Adds the resource usage of one stage to that of the pipeline.
+ */
+static void add_usage(struct rusage *total, const struct rusage *stage) {
+	timeradd(&total->ru_utime, &stage->ru_utime, &total->ru_utime);
+	timeradd(&total->ru_stime, &stage->ru_stime, &total->ru_stime);
+	if (stage->ru_maxrss > total->ru_maxrss)
+		total->ru_maxrss = stage->ru_maxrss;
+	total->ru_minflt += stage->ru_minflt;
+	total->ru_majflt += stage->ru_majflt;
+	total->ru_nvcsw += stage->ru_nvcsw;
+	total->ru_nivcsw += stage->ru_nivcsw;
+}
+
+int run_pipeline(struct command_t *command, PipelineStatus *status) {
+	struct command_t *stage;
+	int count = 0;
+	for (stage = command; stage; stage = stage->next)
+		count++;
+
+	status->stage_count = count;
+	status->pgid = 0;
+	status->statuses = calloc(count, sizeof(int));
+	status->names = calloc(count, sizeof(char *));
+	status->pids = calloc(count, sizeof(pid_t));
+	status->stopped = false;
+	memset(&status->usage, 0, sizeof(status->usage));
+	status->wait_time = 0;
+	pid_t *pids = status->pids;
+
+	bool foreground = !command->background;
+	bool interactive = foreground && isatty(STDIN_FILENO) &&
+					   tcgetpgrp(STDIN_FILENO) == getpgrp();
+
+	// buffered output of the shell must not be duplicated into the children
+	fflush(NULL);
+	double start = now();
+
+	int started = 0, in_fd = STDIN_FILENO, result = 0;
+	for (stage = command; stage; stage = stage->next) {
+		int out_fd = STDOUT_FILENO, next_in_fd = -1;
+		status->names[started] = strdup(stage->name);
+
+		if (stage->next) {
+			int fds[2];
+			if (pipe2(fds, O_CLOEXEC) == -1) {
+				perror("pipe2");
+				result = -1;
+				break;
+			}
+			// a failure here only costs throughput, the pipe still works
+			fcntl(fds[1], F_SETPIPE_SZ, pipe_size());
+			out_fd = fds[1];
+			next_in_fd = fds[0];
+		}
+
+		// the first stage that starts leads the group and takes the terminal
+		bool take_terminal = interactive && status->pgid == 0;
+		const char *path = NULL;
+		int error = 0;
+		pid_t pid = 0;
+		if (!find_builtin(stage->name)) {
+			path = pathcache_lookup(stage->name);
+			if (!path) {
+				error = ENOENT;
+				pid = -1;
+			}
+		}
+		if (pid == 0)
+			pid = spawn_stage(stage, path, status->pgid, in_fd, out_fd,
+							  take_terminal, &error);
+		if (pid == 0)
+			pid = fork_stage(stage, path, status->pgid, in_fd, out_fd,
+							 take_terminal);
+
+		if (pid == -1 && !error) {
+			if (next_in_fd != -1) {
+				close(next_in_fd);
+				close(out_fd);
+			}
+			result = -1;
+			break;
+		}
+
+		if (pid == -1) {
+			// the rest of the pipeline still runs, like in other shells
+			if (!path)
+				fprintf(stderr, "-%s: %s: command not found\n", sysname,
+						stage->name);
+			else
+				fprintf(stderr, "-%s: %s: %s\n", sysname, stage->name,
+						strerror(error));
+			status->statuses[started] = PIPELINE_EXEC_FAILED << 8;
+		} else {
+			// set the group from both sides so neither process races the
+			// other
+			if (status->pgid == 0)
+				status->pgid = pid;
+			setpgid(pid, status->pgid);
+		}
+		pids[started++] = pid;
+
+		if (in_fd != STDIN_FILENO)
+			close(in_fd);
+		if (out_fd != STDOUT_FILENO)
+			close(out_fd);
+		in_fd = next_in_fd;
+	}
+
+	if (in_fd != STDIN_FILENO)
+		close(in_fd);
+	// stages after a failed pipe2 or fork never ran and count as failed
+	for (int i = started; i < count; ++i, stage = stage->next) {
+		if (!status->names[i])
+			status->names[i] = strdup(stage->name);
+		status->statuses[i] = PIPELINE_EXEC_FAILED << 8;
+		pids[i] = -1;
+	}
+	status->spawn_time = now() - start;
+
+	if (status->pgid == 0 || !foreground)
+		return result;
+
+	if (interactive)
+		give_terminal(status->pgid);
+
+	start = now();
+	for (int i = 0; i < started; ++i) {
+		if (pids[i] == -1)
+			continue;
+
+		struct rusage usage = { 0 };
+		while (wait4(pids[i], &status->statuses[i], WUNTRACED, &usage) == -1 &&
+			   errno == EINTR)
+			;
+		add_usage(&status->usage, &usage);
+
+		if (WIFSTOPPED(status->statuses[i])) {
+			// the caller hands the group over to the job table
+			status->stopped = true;
+			break;
+		}
+		pids[i] = -1;
+
+		if (WIFSIGNALED(status->statuses[i])) {
+			int sig = WTERMSIG(status->statuses[i]);
+			// a reader closing early is normal for pipelines
+			if (sig != SIGPIPE && sig != SIGINT)
+				fprintf(stderr, "-%s: %s: %s\n", sysname, status->names[i],
+						strsignal(sig));
+		}
+	}
+
+	status->wait_time = now() - start;
+	if (interactive)
+		give_terminal(getpgrp());
+
+	return result;
+}
+
+void print_pipeline_status(const PipelineStatus *status) {
+	for (int i = 0; i < status->stage_count; ++i) {
+		int s = status->statuses[i];
+		const char *name = status->names[i] ? status->names[i] : "?";
+
+		if (WIFEXITED(s)) {
+			printf("%d: %s: exited with status %d\n", i + 1, name,
+				   WEXITSTATUS(s));
+		} else if (WIFSIGNALED(s)) {
+			printf("%d: %s: killed by signal %d (%s)\n", i + 1, name,
+				   WTERMSIG(s), strsignal(WTERMSIG(s)));
+		} else if (WIFSTOPPED(s)) {
+			printf("%d: %s: stopped\n", i + 1, name);
+		}
+	}
+}
+
+void free_pipeline_status(PipelineStatus *status) {
+	for (int i = 0; i < status->stage_count; ++i)
+		free(status->names[i]);
+	free(status->names);
+	free(status->statuses);
+	free(status->pids);
+	memset(status, 0, sizeof(*status));
+}
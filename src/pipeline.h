@@ -0,0 +1,57 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "shell.h"
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+typedef struct {
+	int stage_count; // Number of commands in the pipeline
+	pid_t pgid; // Process group shared by every stage
+	int *statuses; // Wait status of each stage, in pipeline order
+	char **names; // Command name of each stage, for reporting
+	pid_t *pids; // Process of each stage, -1 once reaped or if it failed to start
+	bool stopped; // A stage of the foreground pipeline was stopped
+	struct rusage usage; // Summed over the stages waited for, ru_maxrss is the largest
+	double spawn_time; // Seconds spent starting the stages
+	double wait_time; // Seconds spent waiting for them
+} PipelineStatus;
+
+// exit statuses of the last foreground pipeline, shown by "pipestatus"
+extern PipelineStatus last_pipeline;
+
+/**
+ * Applies the <, > and >> redirects of a command to the current process.
+ * @param command Command whose redirects should be opened.
+ * @return 0 on success, -1 if a redirect target could not be opened.
+ */
+int apply_redirects(const struct command_t *command);
+
+/**
+ * Starts every stage of a command->next chain at once, connected by pipes
+ * and placed in one process group. Foreground pipelines are waited for and
+ * the wait status of each stage is stored in status, until they finish or
+ * a stage stops. Background and stopped pipelines are left to the job
+ * table. The resource usage of the stages that were waited for and the
+ * time spent starting and waiting for them are stored as well.
+ * @param command First stage of the pipeline.
+ * @param status Receives the process group and per-stage statuses.
+ * @return 0 on success, -1 if the pipeline could not be started.
+ */
+int run_pipeline(struct command_t *command, PipelineStatus *status);
+
+/**
+ * Moves the terminal's foreground process group to pgid.
+ */
+void give_terminal(pid_t pgid);
+
+/**
+ * Prints the exit status of every stage of a finished pipeline.
+ * @param status Statuses filled in by run_pipeline.
+ */
+void print_pipeline_status(const PipelineStatus *status);
+
+void free_pipeline_status(PipelineStatus *status);
+
+#endif // PIPELINE_H
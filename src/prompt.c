@@ -0,0 +1,170 @@
+#include "prompt.h"
+#include "shell.h"
+#include <limits.h>
+#include <pwd.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef enum {
+	SEGMENT_TEXT,
+	SEGMENT_USER,
+	SEGMENT_SHORT_HOST,
+	SEGMENT_HOST,
+	SEGMENT_CWD,
+	SEGMENT_CWD_BASENAME,
+	SEGMENT_SHELL,
+	SEGMENT_SIGN,
+} SegmentType;
+
+typedef struct {
+	SegmentType type;
+	const char *text; // literal text for SEGMENT_TEXT, not NUL terminated
+	size_t len;
+} Segment;
+
+static char *format; // owns the literal text of the segments
+static Segment *segments;
+static size_t segment_count;
+
+static char user[256];
+static char hostname[HOST_NAME_MAX + 1];
+static char cwd[PATH_MAX];
+static char *text; // rendered prompt
+static size_t text_capacity;
+static bool stale = true;
+
+static void add_segment(SegmentType type, const char *literal, size_t len) {
+	// adjacent literals are merged, "\\$ " is one segment like "$ "
+	if (type == SEGMENT_TEXT && segment_count > 0 &&
+		segments[segment_count - 1].type == SEGMENT_TEXT &&
+		segments[segment_count - 1].text + segments[segment_count - 1].len ==
+			literal) {
+		segments[segment_count - 1].len += len;
+		return;
+	}
+	segments = realloc(segments, (segment_count + 1) * sizeof(Segment));
+	segments[segment_count++] = (Segment){ type, literal, len };
+}
+
+/**
+ * Splits the format into literal text and placeholders. Escapes are
+ * rewritten in place so that every literal stays a slice of the format.
+ */
+static void compile(const char *source) {
+	format = strdup(source);
+	char *write = format;
+	for (const char *read = source; *read; ++read) {
+		if (*read != '\\' || !read[1]) {
+			*write = *read;
+			add_segment(SEGMENT_TEXT, write++, 1);
+			continue;
+		}
+		SegmentType type;
+		switch (*++read) {
+		case 'u':
+			type = SEGMENT_USER;
+			break;
+		case 'h':
+			type = SEGMENT_SHORT_HOST;
+			break;
+		case 'H':
+			type = SEGMENT_HOST;
+			break;
+		case 'w':
+			type = SEGMENT_CWD;
+			break;
+		case 'W':
+			type = SEGMENT_CWD_BASENAME;
+			break;
+		case 's':
+			type = SEGMENT_SHELL;
+			break;
+		case '$':
+			type = SEGMENT_SIGN;
+			break;
+		default:
+			// \\ and unknown escapes stand for the character itself
+			*write = *read;
+			add_segment(SEGMENT_TEXT, write++, 1);
+			continue;
+		}
+		add_segment(type, NULL, 0);
+	}
+}
+
+void prompt_init() {
+	const char *source = getenv(PROMPT_VARIABLE);
+	compile(source ? source : PROMPT_DEFAULT_FORMAT);
+
+	const char *name = getenv("USER");
+	if (!name) {
+		struct passwd *pw = getpwuid(geteuid());
+		name = pw ? pw->pw_name : "";
+	}
+	snprintf(user, sizeof(user), "%s", name);
+	if (gethostname(hostname, sizeof(hostname)) == -1)
+		hostname[0] = 0;
+	prompt_chdir();
+}
+
+void prompt_chdir() {
+	if (!getcwd(cwd, sizeof(cwd)))
+		snprintf(cwd, sizeof(cwd), "?");
+	stale = true;
+}
+
+static void append(size_t *len, const char *data, size_t n) {
+	if (*len + n + 1 > text_capacity) {
+		text_capacity = (*len + n + 1) * 2;
+		text = realloc(text, text_capacity);
+	}
+	memcpy(text + *len, data, n);
+	*len += n;
+}
+
+const char *prompt_text() {
+	if (!stale)
+		return text;
+
+	size_t len = 0;
+	for (size_t i = 0; i < segment_count; ++i) {
+		const Segment *segment = &segments[i];
+		const char *value = "";
+		switch (segment->type) {
+		case SEGMENT_TEXT:
+			append(&len, segment->text, segment->len);
+			continue;
+		case SEGMENT_USER:
+			value = user;
+			break;
+		case SEGMENT_SHORT_HOST:
+			append(&len, hostname, strcspn(hostname, "."));
+			continue;
+		case SEGMENT_HOST:
+			value = hostname;
+			break;
+		case SEGMENT_CWD:
+			value = cwd;
+			break;
+		case SEGMENT_CWD_BASENAME: {
+			const char *slash = strrchr(cwd, '/');
+			value = slash && slash[1] ? slash + 1 : cwd;
+			break;
+		}
+		case SEGMENT_SHELL:
+			value = sysname;
+			break;
+		case SEGMENT_SIGN:
+			value = geteuid() == 0 ? "#" : "$";
+			break;
+		}
+		append(&len, value, strlen(value));
+	}
+	append(&len, "", 0);
+	text[len] = 0;
+	stale = false;
+	return text;
+}
@@ -0,0 +1,33 @@
+#ifndef PROMPT_H
+#define PROMPT_H
+
+// environment variable holding the prompt format
+#define PROMPT_VARIABLE "SHELLECT_PROMPT"
+
+// format used when PROMPT_VARIABLE is not set, same as the old prompt
+#define PROMPT_DEFAULT_FORMAT "\\u@\\H:\\w \\s$ "
+
+/**
+ * Compiles the prompt format once into a list of segments and caches the
+ * user, hostname and working directory, so that no system call is made
+ * per prompt. The format is taken from $SHELLECT_PROMPT and understands
+ * \u (user), \h (short hostname), \H (hostname), \w (working directory),
+ * \W (its last component), \s (shell name), \$ ('#' for root, '$'
+ * otherwise) and \\.
+ */
+void prompt_init();
+
+/**
+ * Refreshes the cached working directory. Called after a successful cd,
+ * the only way the shell's own directory changes.
+ */
+void prompt_chdir();
+
+/**
+ * Returns the rendered prompt. The text is only rebuilt after prompt_chdir,
+ * so it can be handed to lineedit_read as is and written in one go.
+ * @return Prompt text, valid until the next prompt_chdir.
+ */
+const char *prompt_text();
+
+#endif // PROMPT_H
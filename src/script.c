@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+#include "script.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Bytes read from a script per read(), the buffer grows for longer lines
+#define SCRIPT_BLOCK (64 << 10)
+
+struct ScriptReader {
+	int fd; // -1 for a "-c" string
+	bool own_fd; // fd was opened for the script and is closed with it
+	bool seekable; // fd is stdin and can be rewound for commands
+	off_t synced; // Offset stdin was rewound to, -1 if it was not
+	char *buffer; // Unread input is buffer[start, length)
+	size_t start;
+	size_t length;
+	size_t capacity;
+	bool eof;
+};
+
+static ScriptReader *script_open_fd(int fd, bool own_fd) {
+	ScriptReader *script = calloc(1, sizeof(ScriptReader));
+	script->fd = fd;
+	script->own_fd = own_fd;
+	script->seekable = !own_fd && lseek(fd, 0, SEEK_CUR) != -1;
+	script->synced = -1;
+	script->capacity = SCRIPT_BLOCK;
+	script->buffer = malloc(script->capacity);
+	return script;
+}
+
+ScriptReader *script_open_file(const char *path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+	return script_open_fd(fd, true);
+}
+
+ScriptReader *script_open_stdin() {
+	return script_open_fd(STDIN_FILENO, false);
+}
+
+ScriptReader *script_open_string(const char *text) {
+	ScriptReader *script = calloc(1, sizeof(ScriptReader));
+	script->fd = -1;
+	script->synced = -1;
+	script->length = strlen(text);
+	script->capacity = script->length + 1;
+	script->buffer = malloc(script->capacity);
+	memcpy(script->buffer, text, script->length);
+	script->eof = true;
+	return script;
+}
+
+/**
+ * Puts stdin back at the end of the buffered input after script_sync,
+ * unless the last command read from it. Then the buffer is dropped and
+ * reading goes on from where the command stopped.
+ */
+static void unsync(ScriptReader *script) {
+	off_t unread = script->length - script->start;
+	off_t offset = lseek(script->fd, unread, SEEK_CUR);
+	if (offset != script->synced + unread) {
+		lseek(script->fd, offset - unread, SEEK_SET);
+		script->start = script->length = 0;
+		script->eof = false;
+	}
+	script->synced = -1;
+}
+
+/**
+ * Reads the next block after the unread input, moving that to the front
+ * of the buffer and growing the buffer if a line does not fit.
+ * @return false at the end of the input.
+ */
+static bool fill(ScriptReader *script) {
+	if (script->eof)
+		return false;
+	size_t unread = script->length - script->start;
+	memmove(script->buffer, script->buffer + script->start, unread);
+	script->start = 0;
+	script->length = unread;
+	// one byte stays free for the terminator of a last line without '\n'
+	if (script->capacity - script->length <= SCRIPT_BLOCK / 2) {
+		script->capacity *= 2;
+		script->buffer = realloc(script->buffer, script->capacity);
+	}
+
+	ssize_t n;
+	while ((n = read(script->fd, script->buffer + script->length,
+					 script->capacity - script->length - 1)) == -1 &&
+		   errno == EINTR)
+		;
+	if (n <= 0) {
+		script->eof = true;
+		return false;
+	}
+	script->length += n;
+	return true;
+}
+
+char *script_read_line(ScriptReader *script) {
+	if (script->synced != -1)
+		unsync(script);
+
+	size_t scanned = script->start;
+	for (;;) {
+		char *line = script->buffer + script->start;
+		char *newline = memchr(script->buffer + scanned, '\n',
+							   script->length - scanned);
+		if (newline) {
+			*newline = '\0';
+			script->start = newline + 1 - script->buffer;
+			return line;
+		}
+		scanned = script->length - script->start;
+		if (!fill(script))
+			break;
+	}
+
+	if (script->start == script->length)
+		return NULL;
+	char *line = script->buffer + script->start;
+	script->buffer[script->length] = '\0';
+	script->start = script->length;
+	return line;
+}
+
+void script_sync(ScriptReader *script) {
+	if (!script->seekable || script->start == script->length)
+		return;
+	script->synced =
+		lseek(script->fd, -(off_t)(script->length - script->start), SEEK_CUR);
+}
+
+void script_close(ScriptReader *script) {
+	if (script->own_fd)
+		close(script->fd);
+	free(script->buffer);
+	free(script);
+}
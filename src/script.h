@@ -0,0 +1,40 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+typedef struct ScriptReader ScriptReader;
+
+/**
+ * Reads the commands of a script file.
+ * @param path Script to open.
+ * @return The reader, or NULL with errno set if the file cannot be opened.
+ */
+ScriptReader *script_open_file(const char *path);
+
+/**
+ * Reads commands piped or redirected to the shell's stdin.
+ */
+ScriptReader *script_open_stdin();
+
+/**
+ * Reads the commands of a "-c" string.
+ */
+ScriptReader *script_open_string(const char *text);
+
+/**
+ * Returns the next line. Input is read in large blocks and lines are cut
+ * out of the block in place, so most lines cost no system call.
+ * @return The line without its newline, valid until the next call, or
+ * NULL at the end of the input.
+ */
+char *script_read_line(ScriptReader *script);
+
+/**
+ * Rewinds a seekable stdin to just after the last line returned, so a
+ * command that reads stdin starts at the next line of the script, as in
+ * other shells. Piped scripts cannot be rewound and do nothing here.
+ */
+void script_sync(ScriptReader *script);
+
+void script_close(ScriptReader *script);
+
+#endif // SCRIPT_H
@@ -0,0 +1,34 @@
+#ifndef SHELL_H
+#define SHELL_H
+
+#include <stdbool.h>
+
+extern const char *sysname;
+
+enum return_codes {
+	SUCCESS = 0,
+	EXIT = 1,
+	UNKNOWN = 2,
+};
+
+// how the pipeline after a command list operator runs
+enum list_op {
+	LIST_ALWAYS = 0, // ; or &
+	LIST_AND, // &&, only if the one before succeeded
+	LIST_OR, // ||, only if the one before failed
+};
+
+struct command_t {
+	char *name;
+	bool background;
+	int arg_count;
+	char **args;
+	char *redirects[3]; // in/out redirection
+	struct command_t *next; // for piping
+	struct command_t *list_next; // next pipeline of a ; && || list
+	enum list_op list_op; // when list_next runs
+	struct arena *arena; // owns the strings and stages of the whole line
+};
+
+
+#endif // SHELL_H